@@ -0,0 +1,230 @@
+/*******************************************************************************
+
+  Class <sphereFiller> 
+
+  Author: Andrew J. Stershic
+          Duke Computational Mechanics Lab (DCML)
+          Duke University - Durham, NC (USA)
+  E-mail: ajs84@duke.edu
+  Web:    www.duke.edu/~ajs84
+
+  Produced at: Oak Ridge National Lab (ORNL) as part of DOE CSGF practicum
+
+  Copyright (c) 2013 Andrew Stershic. All rights reserved. No warranty. No
+  liability.
+
+	This program is free software: you can redistribute it and/or modify it under 		the terms of the GNU General Public License as published by the Free Software 		Foundation, either version 3 of the License, or (at your option) any later 			version.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT ANY 	WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A 	PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License along with 		this program.  If not, see <http://www.gnu.org/licenses/>.
+
+  *Please cite ALL use of code in academic works, presentations, and
+  publications, an example template of which is given by:
+  http://lrweb.beds.ac.uk/guides/ref/cite_computer_program
+
+  *Please cite J. Ferellec, whose works underlie this code:
+   Ferellec, J., and G. McDowell. "Modelling realistic shape and particle inertia in DEM." Géotechnique 60.3 (2010): 227-232.
+   [doi: 10.1680/geot.9.T.015]
+  
+
+*******************************************************************************/
+#include "sphereFiller.h"
+#include <iostream>
+#include <thread>
+
+using namespace std;
+
+/*------------------------------- P U B L I C --------------------------------*/
+
+
+//"--name=value" options may appear anywhere, the rest are positional
+void splitArguments(vector<string>& words, vector<string>& args, map<string,string>& options) {
+	for (unsigned i = 0; i < words.size(); ++i) {
+		string arg = words[i];
+		if (arg.substr(0,2) != "--") {args.push_back(arg); continue;}
+		size_t eq = arg.find("=");
+		if (eq == string::npos) options[arg.substr(2)] = "";
+		else options[arg.substr(2,eq-2)] = arg.substr(eq+1);
+	}
+}
+
+//settings for one input file, from its positional arguments and options
+void configure(SphereFiller& sf, vector<string>& args, map<string,string>& options) {
+
+	assert(args.size() > 0);
+	if (args.size() > 0) {
+		sf.inFile = args[0];
+	}
+	cout << " input file = " << sf.inFile << endl;
+
+	sf.nSphere = 1;
+	if (args.size() > 1) {
+		sf.nSphere = atoi(args[1].c_str());
+	}
+	cout << " number of spheres = " << sf.nSphere << endl;
+
+	sf.density = 1.0;
+	if (args.size() > 2) {
+		sf.density = atof(args[2].c_str());
+	}
+	cout << " density = " << sf.density << endl;
+
+	sf.minDist = 0.0;
+	if (args.size() > 3) {
+		sf.minDist = atof(args[3].c_str());
+	}
+	cout << " minimum distance = " << sf.minDist << endl;
+
+	sf.seed = 0;
+	if (options.count("seed")) {
+		sf.seed = strtoul(options["seed"].c_str(),NULL,10);
+		cout << " random seed = " << sf.seed << endl;
+	}
+
+	sf.selection = SELECT_RANDOM;
+	if (options["select"] == "greedy") {
+		sf.selection = SELECT_GREEDY;
+		cout << " base selection = greedy coverage" << endl;
+	}
+
+	sf.spacing = SPACING_EUCLIDEAN;
+	if (options["spacing"] == "geodesic") {
+		sf.spacing = SPACING_GEODESIC;
+		cout << " minimum distance measured = along surface" << endl;
+	}
+
+	sf.engine = ENGINE_BISECT;
+	if (options["engine"] == "medial") {
+		sf.engine = ENGINE_MEDIAL;
+		cout << " sphere engine = medial axis" << endl;
+	}
+
+	sf.clearance = CLEARANCE_NODES;
+	if (options["clearance"] == "exact") {
+		sf.clearance = CLEARANCE_EXACT;
+		cout << " clearance test = exact (facets)" << endl;
+	}
+
+	//--minRadius=r, --minRadiusRel=f: no sphere below r, or below f times the radius of
+	//a sphere of the particle's volume - the smallest sphere sets the DEM timestep
+	sf.minRadius = 0.0;
+	if (options.count("minRadius")) {
+		sf.minRadius = atof(options["minRadius"].c_str());
+		cout << " minimum sphere radius = " << sf.minRadius << endl;
+	}
+	sf.minRadiusRelative = 0.0;
+	if (options.count("minRadiusRel")) {
+		sf.minRadiusRelative = atof(options["minRadiusRel"].c_str());
+		cout << " minimum sphere radius = " << sf.minRadiusRelative << " x equivalent radius" << endl;
+	}
+
+	sf.library = false;
+	if (args.size() > 4) {
+		sf.library = atoi(args[4].c_str());
+	}
+	string libtext = "no";
+	if ( sf.library ) libtext = "yes";
+	cout << " make library = " << libtext << endl;
+
+	//--dedup[=tolerance]: one template per group of matching particle shapes
+	sf.dedupTolerance = 0.0;
+	if (options.count("dedup")) {
+		sf.dedupTolerance = 0.02;
+		if (options["dedup"] != "") sf.dedupTolerance = atof(options["dedup"].c_str());
+		cout << " library template tolerance = " << sf.dedupTolerance << endl;
+	}
+
+	//--principal: library clumps written in their principal axes
+	sf.principal = (options.count("principal") > 0);
+	if (sf.principal) cout << " library in principal axes = yes" << endl;
+
+	//--weld=tol, --split=none: vertex merging and particle splitting for STL, PLY and OBJ input
+	sf.weldTolerance = 0.0;
+	if (options.count("weld")) {
+		sf.weldTolerance = atof(options["weld"].c_str());
+		cout << " vertex weld tolerance = " << sf.weldTolerance << endl;
+	}
+	sf.splitComponents = (options["split"] != "none");
+	if (!sf.splitComponents) cout << " one particle per surface file = yes" << endl;
+
+	//--budget=N: N spheres in total, shared by particle size and angularity
+	sf.budget = 0;
+	if (options.count("budget")) {
+		sf.budget = atol(options["budget"].c_str());
+		cout << " total sphere budget = " << sf.budget << endl;
+	}
+
+	//--tree[=leaf]: library gets a bounding-sphere tree per molecule
+	sf.treeLeaf = 0;
+	if (options.count("tree")) {
+		sf.treeLeaf = 4;
+		if (options["tree"] != "") sf.treeLeaf = std::max(1, atoi(options["tree"].c_str()));
+		cout << " library sphere trees, atoms per leaf = " << sf.treeLeaf << endl;
+	}
+
+	//--resume: skip particles the journal of an interrupted run records as complete
+	sf.resume = (options.count("resume") > 0);
+	if (sf.resume) cout << " resume from journal = yes" << endl;
+}
+
+int main(int argc, const char *argv[]) {
+
+	vector<string> words(argv+1, argv+argc);
+	vector<string> args;
+	map<string,string> options;
+	splitArguments(words, args, options);
+
+	//--threads=N: fill particles on N threads [default = all cores for a manifest, else 1]
+	int threads = 1;
+	if (options.count("manifest")) threads = std::max(1u, std::thread::hardware_concurrency());
+	if (options.count("threads")) threads = std::max(1, atoi(options["threads"].c_str()));
+
+	//--queue=N: at most N particles read ahead of the writer [default = 2 per thread]
+	int queueDepth = 0;
+	if (options.count("queue")) queueDepth = atoi(options["queue"].c_str());
+
+	//--manifest=file: one input file per line with its own arguments and options,
+	//all particles of all files share one pool of threads
+	if (options.count("manifest")) {
+		ifstream manifest(options["manifest"].c_str());
+		if (!manifest.is_open()) {
+			cout << "*ERROR: cannot open manifest " << options["manifest"] << endl;
+			return 1;
+		}
+		Batch batch;
+		batch.threads = threads;
+		batch.queueDepth = queueDepth;
+		string line;
+		while (getline(manifest,line)) {
+			std::stringstream sstm(line);
+			vector<string> lineWords;
+			string word;
+			while (sstm >> word) lineWords.push_back(word);
+			if (lineWords.empty() || lineWords[0][0] == '#') continue;
+
+			//options on the command line apply to every file unless the line overrides them
+			vector<string> lineArgs;
+			map<string,string> lineOptions(options);
+			splitArguments(lineWords, lineArgs, lineOptions);
+			SphereFiller* sf = new SphereFiller();
+			configure(*sf, lineArgs, lineOptions);
+			batch.files.push_back(sf);
+		}
+		batch.run();
+		for (unsigned i = 0; i < batch.files.size(); ++i) delete batch.files[i];
+		return 1;
+	}
+
+	SphereFiller sf;
+	configure(sf, args, options);
+
+	//reading, filling and writing overlap even on one filling thread
+	Batch batch;
+	batch.threads = threads;
+	batch.queueDepth = queueDepth;
+	batch.files.push_back(&sf);
+	batch.run();
+
+	return 1;
+}
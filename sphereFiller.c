@@ -33,6 +33,18 @@
 #include <iostream>
 #include <fstream>
 #include <string.h>
+#include <queue>
+#include <functional>
+#include <unistd.h>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <zlib.h>
+#ifdef SPHEREFILLER_ZSTD
+#include <zstd.h>
+#endif
 
 using namespace std;
 
@@ -42,65 +54,6 @@ using namespace std;
 
 *******************************************************************************/
 
-/*------------------------------- P U B L I C --------------------------------*/
-
-
-int main(int argc, const char *argv[]) {
-	SphereFiller sf;
-
-	assert(argc > 1);
-	if (argc > 1) {
-		sf.inFile = argv[1];
-	}
-	cout << " input file = " << sf.inFile << endl;
-
-	sf.nSphere = 1;
-	if (argc > 2) {
-		sf.nSphere = atoi(argv[2]);
-	}
-	cout << " number of spheres = " << sf.nSphere << endl;
-
-	sf.density = 1.0;
-	if (argc > 3) {
-		sf.density = atof(argv[3]);
-	}
-	cout << " density = " << sf.density << endl;
-
-	sf.minDist = 0.0;
-	if (argc > 4) {
-		sf.minDist = atof(argv[4]);
-	}
-	cout << " minimum distance = " << sf.minDist << endl;
-
-	sf.library = false;
-	if (argc > 5) {
-		sf.library = atoi(argv[5]);
-	}
-	string libtext = "no";
-	if ( sf.library ) libtext = "yes";
-	cout << " make library = " << libtext << endl;
-
-	//load all then process all, or do one at a time?
-	bool load_all = false;
-
-	//parse input file, save nodes and facets
-	sf.parseInputFile(load_all);
-
-	//build Spheres
-	if (load_all) {
-		for (unsigned i = 0; i < sf.meshroster.size(); ++i) {
-			sf.meshroster[i].buildSpheres(sf.meshroster[i].tag, sf.density, sf.nSphere, sf.minDist, sf.inFile);
-		}
-	}
-
-	//build library
-	if (sf.library) {
-		sf.buildLibrary();
-	}
-
-	return 1;
-}
-
 /*Helper methods--------------------------------------------------------------*/
 
 template<class T> void printVector(vector<T> in) {
@@ -145,7 +98,7 @@ vector<string> strSplitSpaces (string in)  {
 template <class T> void deleteObjects (map<long,T*> a) {
 	for(typename map<long,T*>::iterator it = a.begin(); it != a.end(); it++) {
 		T* ptr = it->second;
-		delete &ptr;
+		delete ptr;
 	}
 	return;
 }
@@ -155,18 +108,392 @@ template <class T, class U> T min(T a, U b) {
 	else return a;
 }
 
+//a node lying on or just beyond an inscribed sphere is represented by it
+const double coverTolerance = 0.1;
+
+double relativeDifference(double a, double b) {
+	double scale = std::max(fabs(a),fabs(b));
+	if (scale == 0.0) return 0.0;
+	return fabs(a-b)/scale;
+}
+
+/*Mat3d methods---------------------------------------------------------------*/
+
+void Mat3d::eigenSymmetric(Vec3d& values, Mat3d& vectors) {
+	//cyclic Jacobi rotations - the matrix is assumed symmetric
+	Mat3d work = *this;
+	vectors = Mat3d::identity();
+
+	for (int sweep = 0; sweep < 50; ++sweep) {
+		double off = 0.0;
+		for (int p = 0; p < 3; ++p) for (int q = p+1; q < 3; ++q) off += fabs(work.a[p][q]);
+		if (off < 1.0e-15) break;
+
+		for (int p = 0; p < 3; ++p) {
+			for (int q = p+1; q < 3; ++q) {
+				if (work.a[p][q] == 0.0) continue;
+				double theta = (work.a[q][q] - work.a[p][p]) / (2.0*work.a[p][q]);
+				double t = 1.0/(fabs(theta) + sqrt(theta*theta + 1.0));
+				if (theta < 0.0) t = -t;
+				double c = 1.0/sqrt(t*t + 1.0);
+				double s = t*c;
+
+				for (int k = 0; k < 3; ++k) {
+					double wkp = work.a[k][p];
+					double wkq = work.a[k][q];
+					work.a[k][p] = c*wkp - s*wkq;
+					work.a[k][q] = s*wkp + c*wkq;
+				}
+				for (int k = 0; k < 3; ++k) {
+					double wpk = work.a[p][k];
+					double wqk = work.a[q][k];
+					work.a[p][k] = c*wpk - s*wqk;
+					work.a[q][k] = s*wpk + c*wqk;
+				}
+				for (int k = 0; k < 3; ++k) {
+					double vkp = vectors.a[k][p];
+					double vkq = vectors.a[k][q];
+					vectors.a[k][p] = c*vkp - s*vkq;
+					vectors.a[k][q] = s*vkp + c*vkq;
+				}
+			}
+		}
+	}
+
+	values = Vec3d(work.a[0][0],work.a[1][1],work.a[2][2]);
+	return;
+}
+
+void Mat3d::toQuaternion(double q[4]) {
+	//rotation matrix to unit quaternion (w, x, y, z)
+	double trace = a[0][0] + a[1][1] + a[2][2];
+	if (trace > 0.0) {
+		double s = 2.0*sqrt(trace + 1.0);
+		q[0] = 0.25*s;
+		q[1] = (a[2][1] - a[1][2])/s;
+		q[2] = (a[0][2] - a[2][0])/s;
+		q[3] = (a[1][0] - a[0][1])/s;
+	} else if (a[0][0] > a[1][1] && a[0][0] > a[2][2]) {
+		double s = 2.0*sqrt(1.0 + a[0][0] - a[1][1] - a[2][2]);
+		q[0] = (a[2][1] - a[1][2])/s;
+		q[1] = 0.25*s;
+		q[2] = (a[0][1] + a[1][0])/s;
+		q[3] = (a[0][2] + a[2][0])/s;
+	} else if (a[1][1] > a[2][2]) {
+		double s = 2.0*sqrt(1.0 + a[1][1] - a[0][0] - a[2][2]);
+		q[0] = (a[0][2] - a[2][0])/s;
+		q[1] = (a[0][1] + a[1][0])/s;
+		q[2] = 0.25*s;
+		q[3] = (a[1][2] + a[2][1])/s;
+	} else {
+		double s = 2.0*sqrt(1.0 + a[2][2] - a[0][0] - a[1][1]);
+		q[0] = (a[1][0] - a[0][1])/s;
+		q[1] = (a[0][2] + a[2][0])/s;
+		q[2] = (a[1][2] + a[2][1])/s;
+		q[3] = 0.25*s;
+	}
+	//keep w positive so equal rotations print identically
+	if (q[0] < 0.0) for (int i = 0; i < 4; ++i) q[i] = -q[i];
+	return;
+}
+
+/*FacetTree methods-----------------------------------------------------------*/
+
+//closest point to p on triangle abc (Ericson, Real-Time Collision Detection 5.1.5)
+Vec3d closestOnTriangle(Vec3d p, Vec3d a, Vec3d b, Vec3d c) {
+	Vec3d ab = b.minus(a);
+	Vec3d ac = c.minus(a);
+	Vec3d ap = p.minus(a);
+	double d1 = ab.dot(ap);
+	double d2 = ac.dot(ap);
+	if (d1 <= 0.0 && d2 <= 0.0) return a;
+
+	Vec3d bp = p.minus(b);
+	double d3 = ab.dot(bp);
+	double d4 = ac.dot(bp);
+	if (d3 >= 0.0 && d4 <= d3) return b;
+
+	double vc = d1*d4 - d3*d2;
+	if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0) return a.plus(ab.mult(d1/(d1-d3)));
+
+	Vec3d cp = p.minus(c);
+	double d5 = ab.dot(cp);
+	double d6 = ac.dot(cp);
+	if (d6 >= 0.0 && d5 <= d6) return c;
+
+	double vb = d5*d2 - d1*d6;
+	if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0) return a.plus(ac.mult(d2/(d2-d6)));
+
+	double va = d3*d6 - d5*d4;
+	if (va <= 0.0 && (d4-d3) >= 0.0 && (d5-d6) >= 0.0) {
+		return b.plus(c.minus(b).mult((d4-d3)/((d4-d3)+(d5-d6))));
+	}
+
+	double denom = 1.0/(va + vb + vc);
+	return a.plus(ab.mult(vb*denom)).plus(ac.mult(vc*denom));
+}
+
+void FacetTree::build(map<long,Facet*>& facetroster) {
+	boxes.clear();
+	facets.clear();
+	vector<Vec3d> centers;
+	for(map<long,Facet*>::iterator it = facetroster.begin(); it != facetroster.end(); it++) {
+		facets.push_back(it->second);
+		centers.push_back(it->second->getCentroid());
+	}
+	if (facets.empty()) return;
+	boxes.reserve(2*facets.size());
+	buildRange(centers, 0, facets.size());
+}
+
+long FacetTree::buildRange(vector<Vec3d>& centers, long first, long count) {
+	long index = boxes.size();
+	boxes.push_back(Box());
+	Box box;
+	box.left = box.right = -1;
+	box.first = first;
+	box.count = count;
+
+	//bounds of the facets, and of their centroids to choose a split
+	double clo[3], chi[3];
+	for (int k = 0; k < 3; ++k) {
+		box.lo[k] = clo[k] = std::numeric_limits<double>::max();
+		box.hi[k] = chi[k] = -std::numeric_limits<double>::max();
+	}
+	for (long f = first; f < first+count; ++f) {
+		for (int v = 0; v < 3; ++v) {
+			Vec3d p = facets[f]->getNode(v)->getCoordinates();
+			double c[3] = {p.getX(),p.getY(),p.getZ()};
+			for (int k = 0; k < 3; ++k) {box.lo[k] = std::min(box.lo[k],c[k]); box.hi[k] = std::max(box.hi[k],c[k]);}
+		}
+		double c[3] = {centers[f].getX(),centers[f].getY(),centers[f].getZ()};
+		for (int k = 0; k < 3; ++k) {clo[k] = std::min(clo[k],c[k]); chi[k] = std::max(chi[k],c[k]);}
+	}
+
+	if (count > 4) {
+		//median split along the widest centroid extent
+		int axis = 0;
+		for (int k = 1; k < 3; ++k) if (chi[k]-clo[k] > chi[axis]-clo[axis]) axis = k;
+		vector< pair<double,long> > keyed;
+		for (long f = first; f < first+count; ++f) {
+			double c[3] = {centers[f].getX(),centers[f].getY(),centers[f].getZ()};
+			keyed.push_back(pair<double,long> (c[axis],f));
+		}
+		long half = count/2;
+		std::nth_element(keyed.begin(), keyed.begin()+half, keyed.end());
+		vector<Facet*> sortedFacets;
+		vector<Vec3d> sortedCenters;
+		for (unsigned i = 0; i < keyed.size(); ++i) {
+			sortedFacets.push_back(facets[keyed[i].second]);
+			sortedCenters.push_back(centers[keyed[i].second]);
+		}
+		for (long i = 0; i < count; ++i) {
+			facets[first+i] = sortedFacets[i];
+			centers[first+i] = sortedCenters[i];
+		}
+		box.left = buildRange(centers, first, half);
+		box.right = buildRange(centers, first+half, count-half);
+		box.count = 0;
+	}
+
+	boxes[index] = box;
+	return index;
+}
+
+bool FacetTree::intersects(Sphere* sph, long& tests, long& visits) {
+	if (boxes.empty()) return false;
+	Vec3d center = sph->getCentroid();
+	double c[3] = {center.getX(),center.getY(),center.getZ()};
+	double r = sph->getRadius();
+	Node* base = sph->getBase();
+
+	vector<long> stack;
+	stack.push_back(0);
+	while (!stack.empty()) {
+		Box& box = boxes[stack.back()];
+		stack.pop_back();
+		visits++;
+
+		//squared distance from the sphere center to the box
+		double d2 = 0.0;
+		for (int k = 0; k < 3; ++k) {
+			double d = 0.0;
+			if (c[k] < box.lo[k]) d = box.lo[k] - c[k];
+			else if (c[k] > box.hi[k]) d = c[k] - box.hi[k];
+			d2 += d*d;
+		}
+		if (d2 >= r*r) continue;
+
+		if (box.left >= 0) {
+			stack.push_back(box.left);
+			stack.push_back(box.right);
+			continue;
+		}
+
+		for (long f = box.first; f < box.first+box.count; ++f) {
+			Facet* facet = facets[f];
+			Node* n[3] = {facet->getNode(0),facet->getNode(1),facet->getNode(2)};
+			tests++;
+			//facets around the base always reach it - only their other corners count
+			if (n[0] == base || n[1] == base || n[2] == base) {
+				for (int k = 0; k < 3; ++k) {
+					if (n[k] != base && sph->containsPoint(n[k])) return true;
+				}
+				continue;
+			}
+			Vec3d closest = closestOnTriangle(center, n[0]->getCoordinates(), n[1]->getCoordinates(), n[2]->getCoordinates());
+			if (closest.minus(center).norm() < r) return true;
+		}
+	}
+	return false;
+}
+
+bool FacetTree::within(Vec3d point, double distance) {
+	if (boxes.empty()) return false;
+	double c[3] = {point.getX(),point.getY(),point.getZ()};
+
+	vector<long> stack;
+	stack.push_back(0);
+	while (!stack.empty()) {
+		Box& box = boxes[stack.back()];
+		stack.pop_back();
+
+		double d2 = 0.0;
+		for (int k = 0; k < 3; ++k) {
+			double d = 0.0;
+			if (c[k] < box.lo[k]) d = box.lo[k] - c[k];
+			else if (c[k] > box.hi[k]) d = c[k] - box.hi[k];
+			d2 += d*d;
+		}
+		if (d2 >= distance*distance) continue;
+
+		if (box.left >= 0) {
+			stack.push_back(box.left);
+			stack.push_back(box.right);
+			continue;
+		}
+
+		for (long f = box.first; f < box.first+box.count; ++f) {
+			Facet* facet = facets[f];
+			Vec3d closest = closestOnTriangle(point, facet->getNode(0)->getCoordinates(), facet->getNode(1)->getCoordinates(), facet->getNode(2)->getCoordinates());
+			if (closest.minus(point).norm() < distance) return true;
+		}
+	}
+	return false;
+}
+
+/*NodeTree methods------------------------------------------------------------*/
+
+void NodeTree::build(vector<Node*>& inNodes) {
+	nodes = inNodes;
+	axis.assign(nodes.size(), 0);
+	boxes.assign(6*nodes.size(), 0.0);
+	buildRange(0, nodes.size());
+	coords.resize(3*nodes.size());
+	for (unsigned i = 0; i < nodes.size(); ++i) {
+		Vec3d c = nodes[i]->getCoordinates();
+		coords[3*i] = c.getX(); coords[3*i+1] = c.getY(); coords[3*i+2] = c.getZ();
+	}
+}
+
+void NodeTree::buildRange(long lo, long hi) {
+	if (hi <= lo) return;
+
+	//bounds of this range, kept for pruning; split on the widest extent
+	long mid = (lo + hi)/2;
+	double* low = &boxes[6*mid];
+	double* high = &boxes[6*mid+3];
+	for (int k = 0; k < 3; ++k) {low[k] = std::numeric_limits<double>::max(); high[k] = -low[k];}
+	for (long i = lo; i < hi; ++i) {
+		Vec3d c = nodes[i]->getCoordinates();
+		double x[3] = {c.getX(),c.getY(),c.getZ()};
+		for (int k = 0; k < 3; ++k) {low[k] = std::min(low[k],x[k]); high[k] = std::max(high[k],x[k]);}
+	}
+	if (hi - lo == 1) return;
+	int split = 0;
+	for (int k = 1; k < 3; ++k) if (high[k]-low[k] > high[split]-low[split]) split = k;
+
+	vector< pair<double,Node*> > keyed;
+	for (long i = lo; i < hi; ++i) {
+		Vec3d c = nodes[i]->getCoordinates();
+		double x[3] = {c.getX(),c.getY(),c.getZ()};
+		keyed.push_back(pair<double,Node*> (x[split],nodes[i]));
+	}
+	std::nth_element(keyed.begin(), keyed.begin()+(mid-lo), keyed.end());
+	for (long i = lo; i < hi; ++i) nodes[i] = keyed[i-lo].second;
+	axis[mid] = split;
+
+	buildRange(lo, mid);
+	buildRange(mid+1, hi);
+}
+
+double NodeTree::boxDistance2(long lo, long hi, double p[3]) {
+	if (hi <= lo) return std::numeric_limits<double>::max();
+	long mid = (lo + hi)/2;
+	double* low = &boxes[6*mid];
+	double* high = &boxes[6*mid+3];
+	double d2 = 0.0;
+	for (int k = 0; k < 3; ++k) {
+		double d = 0.0;
+		if (p[k] < low[k]) d = low[k] - p[k];
+		else if (p[k] > high[k]) d = p[k] - high[k];
+		d2 += d*d;
+	}
+	return d2;
+}
+
+Node* NodeTree::nearest(Vec3d point, Node* skip, double maxDist) {
+	double p[3] = {point.getX(),point.getY(),point.getZ()};
+	Node* best = NULL;
+	double bestD2 = maxDist*maxDist;
+	nearestRange(0, nodes.size(), p, skip, best, bestD2);
+	return best;
+}
+
+void NodeTree::nearestRange(long lo, long hi, double p[3], Node* skip, Node*& best, double& bestD2) {
+	if (boxDistance2(lo, hi, p) >= bestD2) return;
+	long mid = (lo + hi)/2;
+	double* c = &coords[3*mid];
+	if (nodes[mid] != skip) {
+		double d2 = (p[0]-c[0])*(p[0]-c[0]) + (p[1]-c[1])*(p[1]-c[1]) + (p[2]-c[2])*(p[2]-c[2]);
+		if (d2 < bestD2) {bestD2 = d2; best = nodes[mid];}
+	}
+	if (p[axis[mid]] < c[axis[mid]]) {
+		nearestRange(lo, mid, p, skip, best, bestD2);
+		nearestRange(mid+1, hi, p, skip, best, bestD2);
+	} else {
+		nearestRange(mid+1, hi, p, skip, best, bestD2);
+		nearestRange(lo, mid, p, skip, best, bestD2);
+	}
+}
+
+void NodeTree::within(Vec3d point, double radius, vector<Node*>& found) {
+	double p[3] = {point.getX(),point.getY(),point.getZ()};
+	withinRange(0, nodes.size(), p, radius*radius, found);
+}
+
+void NodeTree::withinRange(long lo, long hi, double p[3], double r2, vector<Node*>& found) {
+	if (boxDistance2(lo, hi, p) > r2) return;
+	long mid = (lo + hi)/2;
+	double* c = &coords[3*mid];
+	double d2 = (p[0]-c[0])*(p[0]-c[0]) + (p[1]-c[1])*(p[1]-c[1]) + (p[2]-c[2])*(p[2]-c[2]);
+	if (d2 <= r2) found.push_back(nodes[mid]);
+	withinRange(lo, mid, p, r2, found);
+	withinRange(mid+1, hi, p, r2, found);
+}
+
 /*Mesh methods----------------------------------------------------------------*/
 
 double Mesh::calculateVolume() {
 
 	volume = 0.0;
+	//check orientation vs centroid
+	Vec3d centroid = meshCentroid();
 	for(map<long,Facet*>::iterator it = facetroster.begin(); it != facetroster.end(); it++) {
 		Facet* facet = it->second;
 
 		//get normal
 		Vec3d norm = facet->normal();
-		//check orientation vs centroid
-		Vec3d centroid = meshCentroid();
 		Vec3d facetCentroid = facet->getCentroid();
 		Vec3d diff = centroid.minus(facetCentroid);
 		//want an outward norm - (sphere generation needs an inward norm)
@@ -180,88 +507,429 @@ assert(area>0.0);
 		double dv = facetCentroid.dot(norm)*area*1.0/3.0;		
 		volume += dv;
 	}
-	cout << "*Mesh Volume = " << volume << endl;
 	return volume;
 }
 
-void Mesh::buildSpheres(int particleNum, double density, int nSphere, double minDist, string inFile) {
+void Mesh::clear() {
+	deleteObjects(noderoster);
+	deleteObjects(facetroster);
+	noderoster.clear();
+	facetroster.clear();
+}
 
-	vector<long> idList;
-	vector<Node*> bases;
-	vector<Sphere> sphereList;
+double Mesh::calculateArea() {
+	double area = 0.0;
+	for(map<long,Facet*>::iterator it = facetroster.begin(); it != facetroster.end(); it++) {
+		area += it->second->getArea();
+	}
+	return area;
+}
+
+double Mesh::totalCurvature() {
+	//sum of absolute angle deficits at the nodes, 4*pi for any convex closed surface
+	map<long,double> angleSum;
+	for(map<long,Facet*>::iterator it = facetroster.begin(); it != facetroster.end(); it++) {
+		vector<Node*> nodes = it->second->getNodes();
+		for (int k = 0; k < 3; ++k) {
+			Vec3d a = nodes[(k+1)%3]->getCoordinates().minus(nodes[k]->getCoordinates());
+			Vec3d b = nodes[(k+2)%3]->getCoordinates().minus(nodes[k]->getCoordinates());
+			double denom = a.norm()*b.norm();
+			if (denom > 0.0) angleSum[nodes[k]->getID()] += acos(std::max(-1.0,std::min(1.0,a.dot(b)/denom)));
+		}
+	}
+	double total = 0.0;
+	for(map<long,double>::iterator it = angleSum.begin(); it != angleSum.end(); it++) {
+		total += fabs(2.0*M_PI - it->second);
+	}
+	return total;
+}
+
+Mat3d Mesh::inertiaTensor(Vec3d& center, double& vol) {
+	//volume integrals over the tetrahedra spanned by each facet and the node centroid
+	Vec3d origin = meshCentroid();
+	vol = 0.0;
+	Vec3d first = Vec3d(0.0,0.0,0.0);
+	double second[3][3] = {{0.0,0.0,0.0},{0.0,0.0,0.0},{0.0,0.0,0.0}};
+
+	for(map<long,Facet*>::iterator it = facetroster.begin(); it != facetroster.end(); it++) {
+		Facet* facet = it->second;
+		Vec3d p[3];
+		for (int k = 0; k < 3; ++k) p[k] = facet->getNode(k)->getCoordinates().minus(origin);
+		double dv = p[0].dot(p[1].cross(p[2]))/6.0;
+		Vec3d sum = p[0].plus(p[1]).plus(p[2]);
+
+		vol += dv;
+		first = first.plus(sum.mult(dv/4.0));
+		double c[4][3] = {{p[0].getX(),p[0].getY(),p[0].getZ()},
+		                  {p[1].getX(),p[1].getY(),p[1].getZ()},
+		                  {p[2].getX(),p[2].getY(),p[2].getZ()},
+		                  {sum.getX(),sum.getY(),sum.getZ()}};
+		for (int i = 0; i < 3; ++i) for (int j = 0; j < 3; ++j)
+			for (int k = 0; k < 4; ++k) second[i][j] += dv/20.0*c[k][i]*c[k][j];
+	}
+	//inward-wound meshes integrate to a negative volume
+	if (vol < 0.0) {
+		vol = -vol;
+		first = first.mult(-1.0);
+		for (int i = 0; i < 3; ++i) for (int j = 0; j < 3; ++j) second[i][j] = -second[i][j];
+	}
+
+	//shift second moments to the center of mass, then form the inertia tensor
+	Vec3d shift = first.mult(1.0/vol);
+	center = origin.plus(shift);
+	double m[3] = {shift.getX(),shift.getY(),shift.getZ()};
+	for (int i = 0; i < 3; ++i) for (int j = 0; j < 3; ++j) second[i][j] -= vol*m[i]*m[j];
+	double trace = second[0][0] + second[1][1] + second[2][2];
+	Mat3d inertia;
+	for (int i = 0; i < 3; ++i) for (int j = 0; j < 3; ++j)
+		inertia.set(i,j, (i == j ? trace : 0.0) - second[i][j]);
+	return inertia;
+}
+
+void Mesh::principalFrame(Vec3d& center, Vec3d& moments, Mat3d& axes) {
+	double vol;
+	Mat3d inertia = inertiaTensor(center, vol);
+
+	Vec3d values; Mat3d vectors;
+	inertia.eigenSymmetric(values, vectors);
+
+	//sort ascending so that equal shapes produce equal frames
+	double val[3] = {values.getX(),values.getY(),values.getZ()};
+	int order[3] = {0,1,2};
+	for (int i = 0; i < 3; ++i) for (int j = i+1; j < 3; ++j)
+		if (val[order[j]] < val[order[i]]) std::swap(order[i],order[j]);
+	moments = Vec3d(val[order[0]],val[order[1]],val[order[2]]);
+
+	//fix axis signs by the area-weighted skewness of the surface, keep right-handed
+	Vec3d e[2];
+	for (int k = 0; k < 2; ++k) {
+		e[k] = vectors.getColumn(order[k]);
+		double skew = 0.0;
+		for(map<long,Facet*>::iterator it = facetroster.begin(); it != facetroster.end(); it++) {
+			double d = it->second->getCentroid().minus(center).dot(e[k]);
+			skew += it->second->getArea()*d*d*d;
+		}
+		if (skew < 0.0) e[k] = e[k].mult(-1.0);
+	}
+	axes = Mat3d::columns(e[0], e[1], e[0].cross(e[1]));
+	return;
+}
+
+bool Mesh::overlays(Mesh& target, Mat3d rotation, Vec3d center, Vec3d targetCenter, double tolerance) {
+	//every node, rotated about center and moved onto targetCenter, must lie near the target
+	//surface - so a particle meshed differently still matches
+	if (target.facetTree.empty()) target.facetTree.build(target.facetroster);
+	for(map<long,Node*>::iterator it = noderoster.begin(); it != noderoster.end(); it++) {
+		Vec3d moved = targetCenter.plus(rotation.mult(it->second->getCoordinates().minus(center)));
+		if (!target.facetTree.within(moved, tolerance)) return false;
+	}
+	return true;
+}
+
+void Mesh::fillSpheres(FillOptions options, vector<Sphere>& sphereList, FillReport& report) {
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 
 	//find total volume of particle
 	double totalVolume = calculateVolume();
+	int actualNSphere = min(options.nSphere,noderoster.size());
+
+	clearance = options.clearance;
+	triangleTests = 0;
+	treeVisits = 0;
+	if (clearance == CLEARANCE_EXACT && facetTree.empty()) {
+		facetTree.build(facetroster);
+		report.treeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	engine = options.engine;
+	if (engine == ENGINE_MEDIAL) buildPoles();
+
+	//a single small sphere sets the DEM timestep for the whole assembly
+	double equivalentRadius = cbrt(3.0*fabs(totalVolume)/(4.0*M_PI));
+	radiusFloor = max(options.minRadius, options.minRadiusRelative*equivalentRadius);
+	rejectedBases = 0;
+
+	if (options.selection == SELECT_GREEDY) {
+		selectGreedy(options, actualNSphere, sphereList);
+	} else {
+		selectRandom(options, actualNSphere, sphereList);
+	}
+
 	//use Ferellec's correction - all spheres are same mass regardless of size
-	int actualNSphere = min(nSphere,noderoster.size());
-	double massSphere = totalVolume * density / static_cast<double>(actualNSphere);
+	if (sphereList.size() > 0) {
+		double massSphere = totalVolume * options.density / static_cast<double>(sphereList.size());
+		for (unsigned i = 0; i < sphereList.size(); ++i) sphereList[i].setMass(massSphere);
+	}
 
-	for (int i = 0; i < actualNSphere; ++i) {
+	report.coverage = surfaceCoverage(sphereList);
+	report.triangleTests = triangleTests;
+	report.treeVisits = treeVisits;
+	report.rejected = rejectedBases;
+	if (sphereList.size() > 0) {
+		report.minRadius = std::numeric_limits<double>::max();
+		for (unsigned i = 0; i < sphereList.size(); ++i) {
+			double r = sphereList[i].getRadius();
+			report.minRadius = min(report.minRadius, r);
+			report.maxRadius = max(report.maxRadius, r);
+			report.meanRadius += r/sphereList.size();
+		}
+	}
+	report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
 
-		//pick random nodes
-		map<long,Node*>::iterator item;
-		Node* n1; long id;
+void Mesh::selectRandom(FillOptions options, int nSphere, vector<Sphere>& sphereList) {
 
-		//check valid base node generation
-		bool okay1 = false;
-		bool okay2 = false;
-		while (!okay1 || !okay2) {
+	vector<Node*> bases;
+	//private generator so concurrent fills neither share nor disturb state
+	std::mt19937 rng(options.seed);
+	//mesh edges are only walked to block geodesic spacing
+	if (options.spacing == SPACING_GEODESIC && options.minDist > 0.0) buildNodeGraph();
+	else indexNodes();
+	long n = nodeList.size();
+	vector<bool> blocked(n,false);
+
+	//a node drawn once is used, too close to a base for good (bases only accumulate) or too
+	//small, so it is never tried again; draws go straight to nodeList while most nodes are
+	//left, and to a pool of the survivors, swap-removed as drawn, once few are
+	vector<bool> spent(n,false);
+	long remaining = n;
+	vector<long> pool;
+	bool pooled = false;
+	while (static_cast<int>(sphereList.size()) < nSphere && remaining > 0) {
+		if (!pooled && 8*remaining < n) {
+			for (long k = 0; k < n; ++k) if (!spent[k]) pool.push_back(k);
+			pooled = true;
+		}
+		long k;
+		if (pooled) {
+			long p = rng() % pool.size();
+			k = pool[p];
+			pool[p] = pool.back();
+			pool.pop_back();
+		} else {
+			k = rng() % n;
+			if (spent[k]) continue;
+		}
+		spent[k] = true;
+		remaining--;
+		Node* n1 = nodeList[k];
 
-			item = noderoster.begin();
-			std::advance( item, rand() % noderoster.size() );
-			n1 = item->second;
-			id = item->first;
+		//check distance
+		if (!spacingAllows(n1, bases, options, blocked)) continue;
 
-//			cout << "checking node " << okay1 << " " << okay2 << endl;
-			//correct if node already used
-			okay1 = std::find(idList.begin(), idList.end(), id)==idList.end();
+		//make spheres - iteratively blowing them up
+		Sphere sph1 = inscribeSphere(n1);
+		if (sph1.getRadius() < radiusFloor) {
+			rejectedBases++;
+			continue;
+		}
 
-			//check distance
-			okay2 = true;
-			for (unsigned j = 0; j < bases.size(); ++j) {
-				if (n1->dist(bases[j]) < minDist) {okay2 = false; break;}
-			}		
+		//save Sphere to lists
+		sphereList.push_back(sph1);
+		acceptBase(sph1.getBase(), bases, options, blocked);
+	}
+
+}
+
+void Mesh::selectGreedy(FillOptions options, int nSphere, vector<Sphere>& sphereList) {
+
+	if (options.spacing == SPACING_GEODESIC && options.minDist > 0.0) buildNodeGraph();
+	else indexNodes();
+	long n = nodeList.size();
+
+	//surface area represented by each node
+	vector<double> weight(n,0.0);
+	double totalWeight = 0.0;
+	for(map<long,Facet*>::iterator it = facetroster.begin(); it != facetroster.end(); it++) {
+		Facet* facet = it->second;
+		double share = facet->getArea()/3.0;
+		for (int k = 0; k < 3; ++k) weight[facet->getNode(k)->getIndex()] += share;
+		totalWeight += 3.0*share;
+	}
+
+	//every node's inscribed sphere is a candidate
+	vector<Sphere> candidates;
+	candidates.reserve(n);
+	for (long i = 0; i < n; ++i) candidates.push_back(inscribeSphere(nodeList[i]));
+
+	//nodes each candidate covers, and the candidates covering each node (compressed rows)
+	vector<long> coverStart(n+1,0);
+	vector<long> coverList;
+	vector<long> coveredByStart(n+1,0);
+	if (nodeTree.empty()) nodeTree.build(nodeList);
+	vector<Node*> found;
+	for (long i = 0; i < n; ++i) {
+		found.clear();
+		nodeTree.within(candidates[i].getCentroid(), candidates[i].getRadius()*(1.0 + coverTolerance), found);
+		for (unsigned f = 0; f < found.size(); ++f) {
+			long j = found[f]->getIndex();
+			coverList.push_back(j);
+			coveredByStart[j+1]++;
 		}
+		coverStart[i+1] = coverList.size();
+	}
+	for (long j = 0; j < n; ++j) coveredByStart[j+1] += coveredByStart[j];
+	vector<long> coveredByList(coverList.size());
+	vector<long> fill(coveredByStart.begin(), coveredByStart.end()-1);
+	for (long i = 0; i < n; ++i) {
+		for (long c = coverStart[i]; c < coverStart[i+1]; ++c) coveredByList[fill[coverList[c]]++] = i;
+	}
+
+	//score = uncovered surface area a candidate would add
+	vector<double> score(n,0.0);
+	std::priority_queue< pair<double,long> > queue;
+	for (long i = 0; i < n; ++i) {
+		for (long c = coverStart[i]; c < coverStart[i+1]; ++c) score[i] += weight[coverList[c]];
+		queue.push(pair<double,long> (score[i],i));
+	}
 
-		//max and min distance
-		double max = 0.0;
-		double min = std::numeric_limits<double>::max();
-		for(map<long,Node*>::iterator it = noderoster.begin(); it != noderoster.end(); it++) {
-			if (it->first == id) continue;
-			Node* n = it->second;
-			double dist = n1->dist(n);
-			if (dist < min) {min = dist;}
-			if (dist > max) {max = dist;}
+	vector<bool> covered(n,false);
+	vector<bool> used(n,false);
+	vector<bool> blocked(n,false);
+	vector<Node*> bases;
+
+	//too-small candidates still count towards coverage scores but are never picked
+	for (long i = 0; i < n; ++i) {
+		if (candidates[i].getRadius() < radiusFloor) {used[i] = true; rejectedBases++;}
+	}
+	while (static_cast<int>(sphereList.size()) < nSphere && !queue.empty()) {
+		pair<double,long> top = queue.top();
+		queue.pop();
+		long i = top.second;
+		if (used[i]) continue;
+
+		//scores only ever fall, so a stale entry is requeued at its current value
+		if (top.first > score[i]) {
+			queue.push(pair<double,long> (score[i],i));
+			continue;
 		}
+		//surface fully covered - more spheres would add nothing
+		if (score[i] <= 1.0e-12*totalWeight) break;
+
+		//bases only accumulate, so a node too close now is too close for good
+		used[i] = true;
+		if (!spacingAllows(nodeList[i], bases, options, blocked)) continue;
+
+		sphereList.push_back(candidates[i]);
+		acceptBase(nodeList[i], bases, options, blocked);
+
+		//only candidates sharing a newly covered node change score
+		for (long c = coverStart[i]; c < coverStart[i+1]; ++c) {
+			long j = coverList[c];
+			if (covered[j]) continue;
+			covered[j] = true;
+			for (long k = coveredByStart[j]; k < coveredByStart[j+1]; ++k) score[coveredByList[k]] -= weight[j];
+		}
+	}
 
-		//find normal direction
-		Vec3d normal = generateNormal(n1);
-		//make spheres - iteratively blowing them up
-		Sphere sph1 = Sphere(n1, min, normal, massSphere);
+}
+
+Sphere Mesh::inscribeSphere(Node* n1) {
+	if (engine == ENGINE_MEDIAL) return poles[n1->getIndex()];
+
+	//max and min distance
+	double max = 0.0;
+	double min = std::numeric_limits<double>::max();
+	for(map<long,Node*>::iterator it = noderoster.begin(); it != noderoster.end(); it++) {
+		Node* n = it->second;
+		if (n == n1) continue;
+		double dist = n1->dist(n);
+		if (dist < min) {min = dist;}
+		if (dist > max) {max = dist;}
+	}
 
-		//get right size of sphere
-		bisectRadius(&sph1,min*0.1*0.5,max*10.0*0.5,0);
+	//find normal direction
+	Vec3d normal = generateNormal(n1);
+	Sphere sph1 = Sphere(n1, min, normal, 0.0);
 
-//		cout << "radius = " << sph1.getRadius() << endl;
-//		cout << "center = " << sph1.getCentroid().print() << endl;
+	//get right size of sphere
+	bisectRadius(&sph1,min*0.1*0.5,max*10.0*0.5,0);
+	return sph1;
+}
 
-		//save Sphere to lists
-		sphereList.push_back(sph1);
-		bases.push_back(sph1.getBase());
-		idList.push_back(sph1.getBase()->getID());
+void Mesh::buildPoles() {
+	//shrinking-ball medial axis transform (Ma et al. 2012): every node's ball starts
+	//larger than the particle and is shrunk onto the nearest node it swallows
+	indexNodes();
+	if (nodeTree.empty()) nodeTree.build(nodeList);
+
+	double lo[3], hi[3];
+	for (int k = 0; k < 3; ++k) {lo[k] = std::numeric_limits<double>::max(); hi[k] = -lo[k];}
+	for (unsigned i = 0; i < nodeList.size(); ++i) {
+		Vec3d c = nodeList[i]->getCoordinates();
+		double x[3] = {c.getX(),c.getY(),c.getZ()};
+		for (int k = 0; k < 3; ++k) {lo[k] = std::min(lo[k],x[k]); hi[k] = std::max(hi[k],x[k]);}
 	}
+	double diagonal = Vec3d(hi[0]-lo[0],hi[1]-lo[1],hi[2]-lo[2]).norm();
+
+	poles.clear();
+	poles.reserve(nodeList.size());
+	for (unsigned i = 0; i < nodeList.size(); ++i) {
+		Node* base = nodeList[i];
+		Vec3d p = base->getCoordinates();
+		Vec3d normal = generateNormal(base);
+		double length = normal.norm();
+		if (length > 0.0) normal = normal.mult(1.0/length);
+
+		double radius = diagonal;
+		for (int iter = 0; iter < 50 && length > 0.0; ++iter) {
+			//only nodes inside the current ball can shrink it - none left means it is empty
+			Vec3d center = p.plus(normal.mult(radius));
+			Node* q = nodeTree.nearest(center, base, radius*(1.0 - 1.0e-9));
+			if (!q) break;
+			//ball tangent at the base that passes through q
+			Vec3d d = q->getCoordinates().minus(p);
+			double along = normal.dot(d);
+			if (along <= 0.0) break;
+			double next = d.dot(d)/(2.0*along);
+			if (next >= radius) break;
+			radius = next;
+		}
 
-	//write spheres to file
-	string outFile = inFile.substr(0,inFile.size()-3) + "out";
-	ofstream myfile;
-	myfile.open (outFile.c_str(), ios::app);
+		Sphere sph = Sphere(base, radius, normal, 0.0);
+		if (clearance == CLEARANCE_EXACT && !clearSphere(&sph)) bisectRadius(&sph,radius*0.05,radius,0);
+		poles.push_back(sph);
+	}
+}
+
+bool Mesh::coversNode(Sphere* sph, Node* node) {
+	Vec3d diff = sph->getCentroid().minus(node->getCoordinates());
+	return (diff.norm() <= sph->getRadius()*(1.0 + coverTolerance));
+}
+
+double Mesh::surfaceCoverage(vector<Sphere>& sphereList) {
+	indexNodes();
+	if (nodeTree.empty()) nodeTree.build(nodeList);
+
+	vector<bool> covered(nodeList.size(),false);
+	vector<Node*> found;
 	for (unsigned i = 0; i < sphereList.size(); ++i) {
-		myfile << particleNum << " " << sphereList[i].print();
+		found.clear();
+		nodeTree.within(sphereList[i].getCentroid(), sphereList[i].getRadius()*(1.0 + coverTolerance), found);
+		for (unsigned f = 0; f < found.size(); ++f) covered[found[f]->getIndex()] = true;
 	}
-	myfile.close();
 
-	cout << "*SPHERES BUILT - " << min(nSphere,noderoster.size()) << endl;
+	double coveredArea = 0.0;
+	double total = 0.0;
+	for(map<long,Facet*>::iterator it = facetroster.begin(); it != facetroster.end(); it++) {
+		Facet* facet = it->second;
+		double share = facet->getArea()/3.0;
+		for (int k = 0; k < 3; ++k) {
+			total += share;
+			if (covered[facet->getNode(k)->getIndex()]) coveredArea += share;
+		}
+	}
+	if (total == 0.0) return 0.0;
+	return coveredArea/total;
+}
 
+void Mesh::indexNodes() {
+	nodeList.clear();
+	for(map<long,Node*>::iterator it = noderoster.begin(); it != noderoster.end(); it++) {
+		it->second->setIndex(nodeList.size());
+		nodeList.push_back(it->second);
+	}
 }
 
 void Mesh::bisectRadius(Sphere* sph, double rSmall, double rBig, int count) {
@@ -283,6 +951,8 @@ void Mesh::bisectRadius(Sphere* sph, double rSmall, double rBig, int count) {
 }
 
 bool Mesh::clearSphere(Sphere* sph) {
+	if (clearance == CLEARANCE_EXACT) return !facetTree.intersects(sph, triangleTests, treeVisits);
+
 	int count = 0;
 	for(map<long,Node*>::iterator it = noderoster.begin(); it != noderoster.end(); it++) {
 		Node* node = it->second;
@@ -325,121 +995,799 @@ Vec3d Mesh::generateNormal(Node* n1) {
 
 void Mesh::buildNodeGraph() {
 
+	//every facet edge in both directions, sorted and made unique, becomes compressed rows
+	indexNodes();
+	vector< pair<long,long> > edges;
+	edges.reserve(6*facetroster.size());
 	for(map<long,Facet*>::iterator it = facetroster.begin(); it != facetroster.end(); it++) {
 		Facet* facet = it->second;
-		Node* n1 = facet->getNode(0);
-		Node* n2 = facet->getNode(1);
-		Node* n3 = facet->getNode(2);
-		n1->neighbors.insert(n2); n1->neighbors.insert(n3);
-		n2->neighbors.insert(n1); n2->neighbors.insert(n3);
-		n3->neighbors.insert(n1); n3->neighbors.insert(n2);
+		long n1 = facet->getNode(0)->getIndex();
+		long n2 = facet->getNode(1)->getIndex();
+		long n3 = facet->getNode(2)->getIndex();
+		edges.push_back(pair<long,long> (n1,n2)); edges.push_back(pair<long,long> (n1,n3));
+		edges.push_back(pair<long,long> (n2,n1)); edges.push_back(pair<long,long> (n2,n3));
+		edges.push_back(pair<long,long> (n3,n1)); edges.push_back(pair<long,long> (n3,n2));
+	}
+	std::sort(edges.begin(), edges.end());
+	edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+	adjStart.assign(nodeList.size()+1, 0);
+	adjList.resize(edges.size());
+	for (unsigned e = 0; e < edges.size(); ++e) {
+		adjStart[edges[e].first+1]++;
+		adjList[e] = edges[e].second;
 	}
+	for (unsigned i = 0; i < nodeList.size(); ++i) adjStart[i+1] += adjStart[i];
 
-	cout << "*NODE GRAPH BUILT" << endl;
-	
 	return;
 }
 
 void Mesh::printNodeGraph() {
 
-	for(map<long,Node*>::iterator it = noderoster.begin(); it != noderoster.end(); it++) {
+	for (unsigned i = 0; i < nodeList.size(); ++i) {
 
-		Node* node = it->second;
+		Node* node = nodeList[i];
 		cout << endl;
 		cout << "<" << node->getID() << ">" << endl;
-		for (Node* n : node->neighbors){
-			cout << n->getID() << endl;
+		for (long e = adjStart[i]; e < adjStart[i+1]; ++e){
+			cout << nodeList[adjList[e]]->getID() << endl;
+		}
+	}
+
+}
+
+bool Mesh::spacingAllows(Node* node, vector<Node*>& bases, FillOptions& options, vector<bool>& blocked) {
+	if (options.spacing == SPACING_GEODESIC) return !blocked[node->getIndex()];
+	for (unsigned j = 0; j < bases.size(); ++j) {
+		if (node->dist(bases[j]) < options.minDist) return false;
+	}
+	return true;
+}
+
+void Mesh::acceptBase(Node* node, vector<Node*>& bases, FillOptions& options, vector<bool>& blocked) {
+	bases.push_back(node);
+	if (options.spacing == SPACING_GEODESIC && options.minDist > 0.0) {
+		blockGeodesic(node->getIndex(), options.minDist, blocked);
+	}
+}
+
+void Mesh::blockGeodesic(long source, double radius, vector<bool>& blocked) {
+	//Dijkstra along mesh edges, abandoned once the nearest open node is radius away
+	if (geodesicDist.size() != nodeList.size()) geodesicDist.assign(nodeList.size(), std::numeric_limits<double>::max());
+	vector<long> touched;
+	std::priority_queue< pair<double,long>, vector< pair<double,long> >, std::greater< pair<double,long> > > open;
+	geodesicDist[source] = 0.0;
+	touched.push_back(source);
+	open.push(pair<double,long> (0.0,source));
+
+	while (!open.empty()) {
+		double d = open.top().first;
+		long i = open.top().second;
+		open.pop();
+		if (d >= radius) break;
+		if (d > geodesicDist[i]) continue;
+		blocked[i] = true;
+		for (long e = adjStart[i]; e < adjStart[i+1]; ++e) {
+			long j = adjList[e];
+			double dj = d + nodeList[i]->dist(nodeList[j]);
+			if (dj >= radius || dj >= geodesicDist[j]) continue;
+			if (geodesicDist[j] == std::numeric_limits<double>::max()) touched.push_back(j);
+			geodesicDist[j] = dj;
+			open.push(pair<double,long> (dj,j));
+		}
+	}
+
+	//leave the scratch distances clean for the next base
+	for (unsigned t = 0; t < touched.size(); ++t) geodesicDist[touched[t]] = std::numeric_limits<double>::max();
+}
+
+/*InputReader methods---------------------------------------------------------*/
+
+//decompresses a file in fixed-size chunks as it is read; plain files pass through
+class DecompressBuf : public std::streambuf {
+public:
+	DecompressBuf () : gz(NULL), raw(NULL), zstd(false), broken(false) {};
+	~DecompressBuf () {
+		if (gz) gzclose(gz);
+		if (raw) fclose(raw);
+#ifdef SPHEREFILLER_ZSTD
+		if (zstd) ZSTD_freeDStream(dstream);
+#endif
+	};
+
+	bool open(string path) {
+		source = path;
+		FILE* probe = fopen(path.c_str(), "rb");
+		if (!probe) return false;
+		unsigned char magic[4] = {0,0,0,0};
+		size_t got = fread(magic, 1, 4, probe);
+		fclose(probe);
+		if (got == 4 && magic[0] == 0x28 && magic[1] == 0xB5 && magic[2] == 0x2F && magic[3] == 0xFD) {
+#ifdef SPHEREFILLER_ZSTD
+			raw = fopen(path.c_str(), "rb");
+			dstream = ZSTD_createDStream();
+			ZSTD_initDStream(dstream);
+			packed.resize(ZSTD_DStreamInSize());
+			input.src = &packed[0];
+			input.size = 0;
+			input.pos = 0;
+			frameLeft = 0;
+			zstd = true;
+			return raw != NULL;
+#else
+			cout << "*ERROR: " << path << " is zstd compressed - rebuild with -DSPHEREFILLER_ZSTD" << endl;
+			return false;
+#endif
+		}
+		//zlib reads gzip members and uncompressed files alike
+		gz = gzopen(path.c_str(), "rb");
+		if (!gz) return false;
+		gzbuffer(gz, chunk);
+		return true;
+	};
+
+	//true once the data proved corrupt or cut short - what was read before stays good
+	bool failed() {return broken;};
+
+protected:
+	int_type underflow() {
+		if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+		buffer.resize(chunk);
+		long got = 0;
+		if (broken) return traits_type::eof();
+		if (gz) {
+			got = gzread(gz, &buffer[0], chunk);
+			//a cut-off gzip stream ends with no bytes but a buffer error, not a clean end
+			int status = Z_OK;
+			const char* message = gzerror(gz, &status);
+			if (got < 0 || (got == 0 && status != Z_OK)) {
+				string reason = message;
+				if (reason.compare(0, source.size()+2, source + ": ") == 0) reason.erase(0, source.size()+2);
+				return fail(reason);
+			}
+		}
+#ifdef SPHEREFILLER_ZSTD
+		while (zstd && got == 0) {
+			if (input.pos == input.size) {
+				input.size = fread(&packed[0], 1, packed.size(), raw);
+				input.pos = 0;
+				if (input.size == 0) {
+					if (ferror(raw)) return fail("read error");
+					if (frameLeft != 0) return fail("unexpected end of file inside a zstd frame");
+					break;
+				}
+			}
+			ZSTD_outBuffer output = {&buffer[0], buffer.size(), 0};
+			frameLeft = ZSTD_decompressStream(dstream, &output, &input);
+			if (ZSTD_isError(frameLeft)) return fail(ZSTD_getErrorName(frameLeft));
+			got = output.pos;
+		}
+#endif
+		if (got <= 0) return traits_type::eof();
+		setg(&buffer[0], &buffer[0], &buffer[0] + got);
+		return traits_type::to_int_type(*gptr());
+	};
+
+private:
+	int_type fail(string reason) {
+		cout << "*ERROR: cannot decompress " << source << " - " << reason << endl;
+		broken = true;
+		return traits_type::eof();
+	};
+
+	static const unsigned chunk = 1 << 18;
+	gzFile gz;
+	FILE* raw;
+	bool zstd;
+	bool broken;
+	string source;
+	vector<char> buffer;
+#ifdef SPHEREFILLER_ZSTD
+	ZSTD_DStream* dstream;
+	vector<char> packed;
+	ZSTD_inBuffer input;
+	size_t frameLeft; //nonzero while a frame is still being decoded
+#endif
+};
+
+bool InputReader::open(string path) {
+	close();
+	broken = false;
+	return push(path);
+}
+
+bool InputReader::push(string path) {
+	if (streams.size() >= 32) {
+		cout << "*ERROR: *INCLUDE nested too deeply at " << path << endl;
+		return false;
+	}
+	DecompressBuf* buffer = new DecompressBuf();
+	if (!buffer->open(path)) {
+		delete buffer;
+		return false;
+	}
+	buffers.push_back(buffer);
+	streams.push_back(new std::istream(buffer));
+	paths.push_back(path);
+	return true;
+}
+
+void InputReader::pop() {
+	delete streams.back();
+	delete buffers.back();
+	streams.pop_back();
+	buffers.pop_back();
+	paths.pop_back();
+}
+
+void InputReader::close() {
+	while (!streams.empty()) pop();
+}
+
+bool InputReader::getline(string& line) {
+	while (!streams.empty()) {
+		if (!std::getline(*streams.back(), line)) {
+			//a damaged file ends the whole read, not just its *INCLUDE level
+			if (static_cast<DecompressBuf*>(buffers.back())->failed()) {
+				broken = true;
+				close();
+				return false;
+			}
+			pop();
+			continue;
+		}
+		if (!line.empty() && line[line.size()-1] == '\r') line.erase(line.size()-1);
+
+		//*INCLUDE, INPUT=file - relative names are taken from the including file's directory
+		string upper = line.substr(0,8);
+		std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+		if (upper != "*INCLUDE") return true;
+		string lower = line;
+		std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+		size_t key = lower.find("input");
+		size_t eq = lower.find("=", key);
+		if (key == string::npos || eq == string::npos) {
+			cout << "*ERROR: *INCLUDE without INPUT= in " << paths.back() << endl;
+			continue;
+		}
+		string name = line.substr(eq+1);
+		name.erase(0, name.find_first_not_of(" \t\""));
+		name.erase(name.find_last_not_of(" \t\"")+1);
+		if (name.find(",") != string::npos) name.erase(name.find(","));
+		if (name[0] != '/' && paths.back().find_last_of("/") != string::npos) {
+			name = paths.back().substr(0, paths.back().find_last_of("/")+1) + name;
+		}
+		if (!push(name)) cout << "*ERROR: cannot open included file " << name << endl;
+	}
+	return false;
+}
+
+/*Surface readers-------------------------------------------------------------*/
+
+//whole file in memory, decompressed if need be
+bool readWholeFile(string path, string& data) {
+	DecompressBuf buffer;
+	if (!buffer.open(path)) return false;
+	data.clear();
+	vector<char> chunk(1 << 20);
+	std::streamsize got;
+	while ((got = buffer.sgetn(&chunk[0], chunk.size())) > 0) data.append(&chunk[0], got);
+	return !buffer.failed();
+}
+
+bool readSTL(string& data, vector<double>& coords, vector<long>& triangles) {
+	//binary unless the size disagrees with the triangle count and the text says solid
+	unsigned count = 0;
+	if (data.size() >= 84) memcpy(&count, &data[80], 4);
+	if (data.size() >= 84 && data.size() == 84 + 50*static_cast<size_t>(count)) {
+		coords.reserve(9*static_cast<size_t>(count));
+		triangles.reserve(3*static_cast<size_t>(count));
+		const char* p = &data[84];
+		for (unsigned t = 0; t < count; ++t, p += 50) {
+			float v[9];
+			memcpy(v, p+12, sizeof(v));
+			for (int k = 0; k < 3; ++k) {
+				triangles.push_back(coords.size()/3);
+				coords.push_back(v[3*k]);
+				coords.push_back(v[3*k+1]);
+				coords.push_back(v[3*k+2]);
+			}
+		}
+		return true;
+	}
+	if (data.compare(0,5,"solid") != 0) return false;
+	size_t at = 0;
+	while ((at = data.find("vertex", at)) != string::npos) {
+		char* p = &data[at+6];
+		triangles.push_back(coords.size()/3);
+		for (int k = 0; k < 3; ++k) coords.push_back(strtod(p, &p));
+		at = p - &data[0];
+	}
+	return triangles.size() > 0 && triangles.size() % 3 == 0;
+}
+
+bool readOBJ(string& data, vector<double>& coords, vector<long>& triangles) {
+	std::stringstream text(data);
+	string line;
+	vector<long> face;
+	while (std::getline(text,line)) {
+		if (line.compare(0,2,"v ") == 0) {
+			char* p = &line[2];
+			for (int k = 0; k < 3; ++k) coords.push_back(strtod(p, &p));
+		} else if (line.compare(0,2,"f ") == 0) {
+			//v, v/vt, v//vn or v/vt/vn - negative indices count back from the last vertex
+			face.clear();
+			std::stringstream words(line.substr(2));
+			string word;
+			long nVertex = coords.size()/3;
+			while (words >> word) {
+				long v = atol(word.c_str());
+				face.push_back(v < 0 ? nVertex + v : v - 1);
+			}
+			for (unsigned k = 2; k < face.size(); ++k) {
+				triangles.push_back(face[0]);
+				triangles.push_back(face[k-1]);
+				triangles.push_back(face[k]);
+			}
 		}
 	}
+	return true;
+}
+
+//bytes in one binary PLY scalar
+int plySize(string type) {
+	if (type == "char" || type == "uchar" || type == "int8" || type == "uint8") return 1;
+	if (type == "short" || type == "ushort" || type == "int16" || type == "uint16") return 2;
+	if (type == "double" || type == "float64") return 8;
+	return 4;
+}
 
+//decode one binary PLY scalar of either byte order
+double readPlyBinary(const char* p, string type, int size, int format) {
+	char bytes[8];
+	memcpy(bytes, p, size);
+	if (format == 2) std::reverse(bytes, bytes+size);
+	if (type == "char" || type == "int8") return *reinterpret_cast<signed char*>(bytes);
+	if (type == "uchar" || type == "uint8") return *reinterpret_cast<unsigned char*>(bytes);
+	if (type == "short" || type == "int16") {short v; memcpy(&v,bytes,2); return v;}
+	if (type == "ushort" || type == "uint16") {unsigned short v; memcpy(&v,bytes,2); return v;}
+	if (type == "int" || type == "int32") {int v; memcpy(&v,bytes,4); return v;}
+	if (type == "uint" || type == "uint32") {unsigned v; memcpy(&v,bytes,4); return v;}
+	if (size == 8) {double v; memcpy(&v,bytes,8); return v;}
+	float v;
+	memcpy(&v,bytes,4);
+	return v;
+}
+
+//one PLY scalar, read as text or binary - false if it runs past the end of the data
+bool readPlyValue(const char*& p, const char* last, string type, int format, double& value) {
+	if (p >= last) return false;
+	if (format == 0) {
+		char* end;
+		value = strtod(p, &end);
+		if (end == p || end > last) return false;
+		p = end;
+		return true;
+	}
+	int size = plySize(type);
+	if (size > last - p) return false;
+	value = readPlyBinary(p, type, size, format);
+	p += size;
+	return true;
+}
+
+bool readPLY(string& data, vector<double>& coords, vector<long>& triangles) {
+	struct Property {string name; string type; string countType; bool list;};
+	struct Element {string name; long count; vector<Property> properties;};
+	vector<Element> elements;
+	int format = -1; //0 ascii, 1 little endian, 2 big endian
+	size_t end = data.find("end_header");
+	if (data.compare(0,3,"ply") != 0 || end == string::npos) return false;
+	std::stringstream header(data.substr(0,end));
+	string line;
+	while (std::getline(header,line)) {
+		vector<string> split = strSplitSpaces(line);
+		if (split.size() >= 2 && split[0] == "format") {
+			if (split[1] == "ascii") format = 0;
+			if (split[1] == "binary_little_endian") format = 1;
+			if (split[1] == "binary_big_endian") format = 2;
+		} else if (split.size() >= 3 && split[0] == "element") {
+			Element element = {split[1], atol(split[2].c_str()), vector<Property>()};
+			elements.push_back(element);
+		} else if (split.size() >= 3 && split[0] == "property" && !elements.empty()) {
+			Property property;
+			property.list = (split[1] == "list" && split.size() >= 5);
+			property.countType = property.list ? split[2] : "";
+			property.type = property.list ? split[3] : split[1];
+			property.name = split.back();
+			elements.back().properties.push_back(property);
+		}
+	}
+	if (format < 0) return false;
+	size_t body = data.find('\n',end);
+	if (body == string::npos) return false;
+	const char* p = &data[body+1];
+	const char* last = &data[0] + data.size();
+
+	vector<long> face;
+	for (unsigned e = 0; e < elements.size(); ++e) {
+		Element& element = elements[e];
+		for (long i = 0; i < element.count; ++i) {
+			if (p >= last) return false;
+			double xyz[3] = {0.0,0.0,0.0};
+			face.clear();
+			for (unsigned k = 0; k < element.properties.size(); ++k) {
+				Property& property = element.properties[k];
+				if (property.list) {
+					double count, index;
+					if (!readPlyValue(p, last, property.countType, format, count)) return false;
+					//a list can't hold more entries than there are bytes left
+					long n = static_cast<long>(count);
+					if (n < 0 || n > (last - p)/(format == 0 ? 1 : plySize(property.type))) return false;
+					for (long j = 0; j < n; ++j) {
+						if (!readPlyValue(p, last, property.type, format, index)) return false;
+						face.push_back(static_cast<long>(index));
+					}
+					if (property.name != "vertex_indices" && property.name != "vertex_index") face.clear();
+				} else {
+					double value;
+					if (!readPlyValue(p, last, property.type, format, value)) return false;
+					if (property.name == "x") xyz[0] = value;
+					if (property.name == "y") xyz[1] = value;
+					if (property.name == "z") xyz[2] = value;
+				}
+			}
+			if (element.name == "vertex") {
+				coords.push_back(xyz[0]);
+				coords.push_back(xyz[1]);
+				coords.push_back(xyz[2]);
+			} else if (element.name == "face") {
+				for (unsigned k = 2; k < face.size(); ++k) {
+					triangles.push_back(face[0]);
+					triangles.push_back(face[k-1]);
+					triangles.push_back(face[k]);
+				}
+			}
+		}
+	}
+	return true;
+}
+
+//merges vertices closer than tolerance - cells are twice the tolerance wide, so besides its own
+//cell a vertex only looks at the neighbours on the near side along each axis (8 cells)
+long weldVertices(vector<double>& coords, double tolerance, vector<long>& welded, vector<double>& unique) {
+	size_t nVertex = coords.size()/3;
+	welded.assign(nVertex, -1);
+	unique.clear();
+	double cellSize = 2.0*tolerance;
+	double tol2 = tolerance*tolerance;
+
+	//open addressing on the cell, each slot heads a chain of welded vertices through next
+	size_t capacity = 1024;
+	vector<long long> slotCell(3*capacity);
+	vector<long> slotHead(capacity, -1);
+	vector<long> next;
+	size_t used = 0;
+	auto slotOf = [&](long long x, long long y, long long z) -> size_t {
+		size_t h = static_cast<size_t>(x*73856093LL ^ y*19349663LL ^ z*83492791LL);
+		h ^= h >> 29;
+		h &= capacity-1;
+		while (slotHead[h] >= 0 && (slotCell[3*h] != x || slotCell[3*h+1] != y || slotCell[3*h+2] != z)) h = (h+1) & (capacity-1);
+		return h;
+	};
+
+	for (size_t v = 0; v < nVertex; ++v) {
+		const double* x = &coords[3*v];
+		long long cell[3], side[3];
+		for (int k = 0; k < 3; ++k) {
+			double scaled = x[k]/cellSize;
+			cell[k] = static_cast<long long>(floor(scaled));
+			side[k] = (scaled - floor(scaled) < 0.5) ? -1 : 1;
+		}
+		long match = -1;
+		for (int c = 0; c < 8 && match < 0; ++c) {
+			size_t h = slotOf(cell[0] + ((c&1) ? side[0] : 0), cell[1] + ((c&2) ? side[1] : 0), cell[2] + ((c&4) ? side[2] : 0));
+			for (long m = slotHead[h]; m >= 0; m = next[m]) {
+				const double* y = &unique[3*m];
+				double dx = x[0]-y[0], dy = x[1]-y[1], dz = x[2]-y[2];
+				if (dx*dx + dy*dy + dz*dz <= tol2) {match = m; break;}
+			}
+		}
+		if (match < 0) {
+			match = unique.size()/3;
+			unique.insert(unique.end(), x, x+3);
+			size_t h = slotOf(cell[0], cell[1], cell[2]);
+			if (slotHead[h] < 0) {
+				slotCell[3*h] = cell[0];
+				slotCell[3*h+1] = cell[1];
+				slotCell[3*h+2] = cell[2];
+				used++;
+			}
+			next.push_back(slotHead[h]);
+			slotHead[h] = match;
+
+			//keep the table at most half full
+			if (2*used > capacity) {
+				vector<long long> oldCell;
+				vector<long> oldHead;
+				oldCell.swap(slotCell);
+				oldHead.swap(slotHead);
+				capacity *= 2;
+				slotCell.assign(3*capacity, 0);
+				slotHead.assign(capacity, -1);
+				for (size_t o = 0; o < oldHead.size(); ++o) {
+					if (oldHead[o] < 0) continue;
+					size_t n = slotOf(oldCell[3*o], oldCell[3*o+1], oldCell[3*o+2]);
+					slotCell[3*n] = oldCell[3*o];
+					slotCell[3*n+1] = oldCell[3*o+1];
+					slotCell[3*n+2] = oldCell[3*o+2];
+					slotHead[n] = oldHead[o];
+				}
+			}
+		}
+		welded[v] = match;
+	}
+	return unique.size()/3;
+}
+
+long findRoot(vector<long>& parent, long v) {
+	while (parent[v] != v) {
+		parent[v] = parent[parent[v]];
+		v = parent[v];
+	}
+	return v;
 }
 
 /*SphereFiller methods--------------------------------------------------------*/
 
+//top-down bounding-sphere tree over a clump's atoms, nodes in depth-first order
+struct TreeNode {Vec3d center; double radius; int left; int right; vector<int> atoms;};
+
+int buildSphereTree(vector<Vec3d>& centers, vector<double>& radii, vector<int>& order, int first, int last, int leafSize, vector<TreeNode>& tree) {
+	//the smaller of the spheres about the box middle and about the mean center
+	Vec3d lo = centers[order[first]], hi = lo, mean = Vec3d(0.0,0.0,0.0);
+	for (int k = first; k < last; ++k) {
+		Vec3d c = centers[order[k]];
+		double r = radii[order[k]];
+		lo = Vec3d(min(lo.getX(),c.getX()-r), min(lo.getY(),c.getY()-r), min(lo.getZ(),c.getZ()-r));
+		hi = Vec3d(max(hi.getX(),c.getX()+r), max(hi.getY(),c.getY()+r), max(hi.getZ(),c.getZ()+r));
+		mean = mean.plus(c);
+	}
+	Vec3d candidates[2] = {lo.plus(hi).mult(0.5), mean.mult(1.0/(last-first))};
+	TreeNode node;
+	node.radius = std::numeric_limits<double>::max();
+	for (int c = 0; c < 2; ++c) {
+		double radius = 0.0;
+		for (int k = first; k < last; ++k) radius = max(radius, centers[order[k]].minus(candidates[c]).norm() + radii[order[k]]);
+		if (radius < node.radius) {node.radius = radius; node.center = candidates[c];}
+	}
+	node.left = 0;
+	node.right = 0;
+	int index = tree.size();
+	tree.push_back(node);
+	if (last - first <= leafSize) {
+		for (int k = first; k < last; ++k) tree[index].atoms.push_back(order[k]);
+		return index;
+	}
+
+	//halve at the median center along the longest side of the box
+	Vec3d size = hi.minus(lo);
+	int axis = 0;
+	if (size.getY() > size.getX()) axis = 1;
+	if (size.getZ() > (axis ? size.getY() : size.getX())) axis = 2;
+	int mid = (first + last)/2;
+	std::nth_element(order.begin()+first, order.begin()+mid, order.begin()+last, [&](int a, int b) {
+		double ca = axis == 0 ? centers[a].getX() : (axis == 1 ? centers[a].getY() : centers[a].getZ());
+		double cb = axis == 0 ? centers[b].getX() : (axis == 1 ? centers[b].getY() : centers[b].getZ());
+		return ca < cb;
+	});
+	int left = buildSphereTree(centers, radii, order, first, mid, leafSize, tree);
+	int right = buildSphereTree(centers, radii, order, mid, last, leafSize, tree);
+	tree[index].left = left;
+	tree[index].right = right;
+	return index;
+}
+
 void SphereFiller::buildLibrary() {
 
-	inFile = inFile.substr(0,inFile.size()-3) + "out";
-	string outFile = inFile.substr(0,inFile.size()-4) + "_library.out";
+	string sphereFile = outputName(".out");
+	string outFile = outputName("_library.out");
 
 	//changing units
 	bool change_mm_to_m = true;
 	double units = 1.0;
 	if (change_mm_to_m) {units = 1000.0; cout << " *(note: units being changed from mm to m in library)" << endl;}
 
-	//open output file, write header
-	ofstream outfile;
-	outfile.open (outFile.c_str(), ios::app);
-	outfile << "*List:" << endl;
+	//read the sphere file once, in file order
+	ifstream infile(sphereFile.c_str());
+	string line;
+	vector<long> atomMolecule;
+	vector<double> atomDiameter;
+	vector<double> atomDensity;
+	vector<Vec3d> atomCentroid;
+	while (getline(infile,line)) {
+		vector<string> split = strSplitSpaces(line);
+		if (split.size() < 6) continue;
+		atomMolecule.push_back(atol(split[0].c_str()));
+		atomDiameter.push_back(atof(split[1].c_str()));
+		atomDensity.push_back(atof(split[2].c_str()));
+		atomCentroid.push_back(Vec3d(atof(split[3].c_str()),atof(split[4].c_str()),atof(split[5].c_str())));
+	}
+	infile.close();
 
 	//for every molecule - get info
-	ifstream infile(inFile.c_str());
-	string line;
+	bool dedup = (dedupTolerance > 0.0);
+	map<long,unsigned> tagIndex;
 	vector<Vec3d> centroidList;
-	vector<long> tagList;
-
+	vector<double> area(meshroster.size(),0.0);
+	vector<Vec3d> center(meshroster.size());
+	vector<Vec3d> moments(meshroster.size());
+	vector<Mat3d> axes(meshroster.size(), Mat3d::identity());
 	for (unsigned i = 0; i < meshroster.size(); ++i) {
-		int nSpheres = 0;
-		Vec3d centroid = meshroster[i].getCentroid();
-		centroidList.push_back(centroid);
-		double volume = meshroster[i].getVolume();
-		double maxRadius = 0.0;
-
-		long molecule = meshroster[i].tag;
-		tagList.push_back(molecule);
-		infile.clear();
-		infile.seekg(0,ios_base::beg);//rewind to beginning
-		while (!infile.eof()) {
-			while (getline(infile,line)) {
-				vector<string> split = strSplitSpaces(line);
-				long molID = atol(split[0].c_str());
-				if (molID != molecule) continue;
-				
-				double rad = atof(split[1].c_str());
-				double x = atof(split[3].c_str());			
-				double y = atof(split[4].c_str());
-				double z = atof(split[5].c_str());
-
-				nSpheres++;
-				Vec3d atomCentroid = Vec3d(x,y,z);
-				Vec3d diff = atomCentroid.minus(centroid);
-				double dist = diff.norm() + rad;
-				if (dist > maxRadius) maxRadius = dist;
+		tagIndex[meshroster[i].tag] = i;
+		if (dedup || principal) {
+			area[i] = meshroster[i].calculateArea();
+			meshroster[i].principalFrame(center[i], moments[i], axes[i]);
+		}
+		//principal output is relative to the center of mass, in principal axes
+		if (principal) centroidList.push_back(center[i]);
+		else centroidList.push_back(meshroster[i].getCentroid());
+	}
+	vector<Mat3d> frameList(meshroster.size(), Mat3d::identity());
+	if (principal) frameList = axes;
+
+	vector<double> maxRadius(meshroster.size(),0.0);
+	vector<int> nSpheres(meshroster.size(),0);
+	for (unsigned a = 0; a < atomMolecule.size(); ++a) {
+		map<long,unsigned>::iterator found = tagIndex.find(atomMolecule[a]);
+		if (found == tagIndex.end()) continue;
+		unsigned i = found->second;
+		nSpheres[i]++;
+		Vec3d diff = atomCentroid[a].minus(centroidList[i]);
+		double dist = diff.norm() + atomDiameter[a];
+		if (dist > maxRadius[i]) maxRadius[i] = dist;
+	}
+
+	//group particles with matching shape signatures, one template per group
+	vector<unsigned> templateOf(meshroster.size());
+	vector<Mat3d> instanceRotation(frameList);
+	vector<Vec3d> instanceTranslation(centroidList);
+	for (unsigned i = 0; i < meshroster.size(); ++i) templateOf[i] = i;
+
+	if (dedup) {
+		multimap<double,unsigned> templatesByVolume;
+
+		for (unsigned i = 0; i < meshroster.size(); ++i) {
+			double volume = fabs(meshroster[i].getVolume());
+
+			//only templates of similar volume can match
+			double lower = volume*(1.0 - dedupTolerance);
+			double upper = (dedupTolerance < 1.0) ? volume/(1.0 - dedupTolerance) : std::numeric_limits<double>::max();
+			Mat3d rotation;
+			for (multimap<double,unsigned>::iterator it = templatesByVolume.lower_bound(lower); it != templatesByVolume.end() && it->first <= upper; it++) {
+				unsigned t = it->second;
+				bool same = relativeDifference(area[i],area[t]) <= dedupTolerance;
+				same = same && relativeDifference(moments[i].getX(),moments[t].getX()) <= dedupTolerance;
+				same = same && relativeDifference(moments[i].getY(),moments[t].getY()) <= dedupTolerance;
+				same = same && relativeDifference(moments[i].getZ(),moments[t].getZ()) <= dedupTolerance;
+				if (!same) continue;
+
+				//the signature can't tell mirror images apart, and principal axes are only fixed up
+				//to sign (or at all, for near-equal moments) - so the geometry itself must overlay,
+				//trying each sign choice that keeps the frame right-handed
+				double tolerance = dedupTolerance*cbrt(volume);
+				for (int flip = 0; flip < 4 && templateOf[i] == i; ++flip) {
+					double s0 = (flip == 1 || flip == 3) ? -1.0 : 1.0;
+					double s1 = (flip == 2 || flip == 3) ? -1.0 : 1.0;
+					Mat3d signs = Mat3d::columns(Vec3d(s0,0.0,0.0), Vec3d(0.0,s1,0.0), Vec3d(0.0,0.0,s0*s1));
+					Mat3d candidate = axes[i].mult(signs).mult(axes[t].transpose());
+					if (meshroster[t].overlays(meshroster[i], candidate, center[t], center[i], tolerance)
+					 && meshroster[i].overlays(meshroster[t], candidate.transpose(), center[i], center[t], tolerance)) {
+						templateOf[i] = t;
+						rotation = candidate;
+					}
+				}
+				if (templateOf[i] != i) break;
 			}
+			if (templateOf[i] == i) {
+				templatesByVolume.insert(pair<double,unsigned> (volume,i));
+				continue;
+			}
+
+			//rigid transform taking template coordinates onto this particle
+			unsigned t = templateOf[i];
+			instanceRotation[i] = rotation.mult(frameList[t]);
+			instanceTranslation[i] = center[i].plus(rotation.mult(centroidList[t].minus(center[t])));
 		}
+		cout << "    unique templates = " << templatesByVolume.size() << " of " << meshroster.size() << " particles" << endl;
+	}
 
+	//open output file, write header
+	ofstream outfile;
+	outfile.open (outFile.c_str(), ios::trunc);
+	outfile << "*List:" << endl;
+	for (unsigned i = 0; i < meshroster.size(); ++i) {
+		if (templateOf[i] != i) continue;
 		//write summary to file
-		outfile << molecule << " " << volume/(units*units*units) << "  " << maxRadius/units << " " << nSpheres << endl;
+		double volume = meshroster[i].getVolume();
+		outfile << meshroster[i].tag << " " << volume/(units*units*units) << "  " << maxRadius[i]/units << " " << nSpheres[i];
+		if (principal) {
+			//principal moments of inertia, then the rotation from principal to original axes
+			double scale = density/(units*units*units*units*units);
+			double q[4];
+			axes[i].toQuaternion(q);
+			outfile << " " << moments[i].getX()*scale << " " << moments[i].getY()*scale << " " << moments[i].getZ()*scale;
+			outfile << " " << q[0] << " " << q[1] << " " << q[2] << " " << q[3];
+		}
+		outfile << endl;
 	}
 
-
 	//copy data to file
 	outfile << endl;
 	outfile << "*Molecules:" << endl;
 	int atom = 0;
-	infile.clear();
-	infile.seekg(0,ios_base::beg);//rewind to beginning
-		while (!infile.eof()) {
-			while (getline(infile,line)) {
-				vector<string> split = strSplitSpaces(line);
-				long molID = atol(split[0].c_str());
-				Vec3d centroid = Vec3d();
-				for (unsigned i = 0; i < tagList.size(); ++i) {
-					long tag = tagList[i];
-					if (tag == molID) centroid = centroidList[i];
-				}
+	map<long, vector<int> > treeAtoms;
+	vector<Vec3d> atomLocal;
+	vector<double> atomSize;
+	for (unsigned a = 0; a < atomMolecule.size(); ++a) {
+		long molID = atomMolecule[a];
+		Vec3d centroid = Vec3d(0.0,0.0,0.0);
+		Mat3d frame = Mat3d::identity();
+		map<long,unsigned>::iterator found = tagIndex.find(molID);
+		if (found != tagIndex.end()) {
+			if (templateOf[found->second] != found->second) continue;
+			centroid = centroidList[found->second];
+			frame = frameList[found->second];
+		}
 
-				double rad = atof(split[1].c_str());
-				double dens = atof(split[2].c_str());	
-				double x = atof(split[3].c_str())-centroid.getX();			
-				double y = atof(split[4].c_str())-centroid.getY();
-				double z = atof(split[5].c_str())-centroid.getZ();
+		double rad = atomDiameter[a];
+		double dens = atomDensity[a];
+		Vec3d local = frame.transpose().mult(atomCentroid[a].minus(centroid));
 
-				atom++;
-				outfile << atom << " " << 1 << " " << x/units << " " << y/units << " " << z/units << " " << rad/units << " " << dens << " " << molID << endl;
+		atom++;
+		outfile << atom << " " << 1 << " " << local.getX()/units << " " << local.getY()/units << " " << local.getZ()/units << " " << rad/units << " " << dens << " " << molID << endl;
+		if (treeLeaf > 0) {
+			treeAtoms[molID].push_back(atomLocal.size());
+			atomLocal.push_back(local.mult(1.0/units));
+			atomSize.push_back(rad/2.0/units); //listed size is a diameter
+		}
+	}
 
+	//bounding-sphere tree per molecule, in the frame and units of its atoms
+	if (treeLeaf > 0) {
+		outfile << endl;
+		outfile << "*Trees:" << endl;
+		long treeNodes = 0;
+		for (map<long, vector<int> >::iterator it = treeAtoms.begin(); it != treeAtoms.end(); it++) {
+			vector<TreeNode> tree;
+			vector<int> order(it->second);
+			buildSphereTree(atomLocal, atomSize, order, 0, order.size(), treeLeaf, tree);
+			treeNodes += tree.size();
+			for (unsigned n = 0; n < tree.size(); ++n) {
+				//padded so the bound still holds after atoms and nodes are printed to 6 digits
+				Vec3d c = tree[n].center;
+				double radius = tree[n].radius + 2e-5*(c.norm() + tree[n].radius);
+				int left = tree[n].left ? tree[n].left+1 : 0;
+				int right = tree[n].right ? tree[n].right+1 : 0;
+				outfile << it->first << " " << n+1 << " " << c.getX() << " " << c.getY() << " " << c.getZ() << " " << radius << " " << left << " " << right;
+				for (unsigned k = 0; k < tree[n].atoms.size(); ++k) outfile << " " << tree[n].atoms[k]+1;
+				outfile << endl;
 			}
 		}
-	infile.close();
+		cout << "    sphere trees = " << treeNodes << " nodes over " << treeAtoms.size() << " molecules" << endl;
+	}
+
+	//placement of every particle as a rotated and translated template
+	if (dedup) {
+		outfile << endl;
+		outfile << "*Instances:" << endl;
+		for (unsigned i = 0; i < meshroster.size(); ++i) {
+			double q[4];
+			instanceRotation[i].toQuaternion(q);
+			Vec3d t = instanceTranslation[i].mult(1.0/units);
+			outfile << meshroster[i].tag << " " << meshroster[templateOf[i]].tag << " " << q[0] << " " << q[1] << " " << q[2] << " " << q[3] << " " << t.getX() << " " << t.getY() << " " << t.getZ() << endl;
+		}
+	}
 
 	outfile.close();
 
@@ -448,24 +1796,274 @@ void SphereFiller::buildLibrary() {
 	return;
 }
 
-void SphereFiller::parseInputFile (bool load_all)  {
-	string path = this->inFile;
-	ifstream infile(path.c_str());
-	int particleNum = 0;
+void SphereFiller::allocateBudget() {
+	//a particle filled with n spheres is taken to miss its shape by c/n, with c growing with
+	//surface area, size and angularity; each sphere goes to the particle whose error drops most
+	allocation.clear();
+	vector<double> weight(meshroster.size());
+	vector<double> curvature(meshroster.size());
+	std::priority_queue<pair<double,unsigned> > gain;
+	long spent = 0;
+	for (unsigned i = 0; i < meshroster.size(); ++i) {
+		Mesh& mesh = meshroster[i];
+		double volume = fabs(mesh.calculateVolume());
+		curvature[i] = mesh.totalCurvature()/(4.0*M_PI);
+		weight[i] = mesh.calculateArea()*cbrt(volume)*curvature[i];
+		allocation[mesh.tag] = 1;
+		spent++;
+		if (mesh.noderoster.size() > 1) gain.push(pair<double,unsigned> (weight[i]/2.0,i));
+	}
+	while (spent < budget && !gain.empty()) {
+		unsigned i = gain.top().second;
+		gain.pop();
+		long n = ++allocation[meshroster[i].tag];
+		spent++;
+		if (n < static_cast<long>(meshroster[i].noderoster.size())) {
+			gain.push(pair<double,unsigned> (weight[i]/static_cast<double>(n) - weight[i]/static_cast<double>(n+1),i));
+		}
+	}
 
-	while (!infile.eof()) {
-		Mesh mesh = Mesh();
+	string budgetFile = outputName("_budget.out");
+	ofstream out(budgetFile.c_str(), ios::trunc);
+	out << "*particle volume area curvature spheres" << endl;
+	long fewest = spent, most = 0;
+	for (unsigned i = 0; i < meshroster.size(); ++i) {
+		Mesh& mesh = meshroster[i];
+		long n = allocation[mesh.tag];
+		out << mesh.tag << " " << mesh.getVolume() << " " << mesh.calculateArea() << " " << curvature[i] << " " << n << endl;
+		fewest = min(fewest,n);
+		most = max(most,n);
+	}
+	out.close();
+
+	cout << "*SPHERE BUDGET ALLOCATED" << endl;
+	cout << "    budget = " << budget << endl;
+	cout << "    spheres allocated = " << spent << endl;
+	cout << "    spheres per particle = " << fewest << " to " << most << endl;
+	cout << "    allocation written to " << budgetFile << endl;
+	if (spent > budget) cout << " *(note: budget is below one sphere per particle)" << endl;
+}
 
-		deleteObjects(mesh.noderoster);
-		deleteObjects(mesh.facetroster);
-		mesh.noderoster.clear();
-		mesh.facetroster.clear();
+string SphereFiller::outputName(string suffix) {
+	//input.inp, input.inp.gz and input.inp.zst all write input.out
+	string stem = inFile;
+	if (stem.size() > 3 && stem.substr(stem.size()-3) == ".gz") stem.erase(stem.size()-3);
+	else if (stem.size() > 4 && stem.substr(stem.size()-4) == ".zst") stem.erase(stem.size()-4);
+	return stem.substr(0,stem.size()-4) + suffix;
+}
+
+string SphereFiller::journalSignature() {
+	std::stringstream sstm;
+	sstm.precision(17);
+	sstm << "*sphereFiller journal: " << inFile << " " << nSphere << " " << density << " " << minDist << " " << seed << " " << selection << " " << spacing << " " << clearance << " " << engine;
+	//vertex welding and splitting decide which surface is which particle
+	if (surfaceFormat() != "") sstm << " weld " << weldTolerance << " " << splitComponents;
+	if (budget > 0) sstm << " budget " << budget;
+	if (minRadius > 0.0 || minRadiusRelative > 0.0) sstm << " minRadius " << minRadius << " " << minRadiusRelative;
+	return sstm.str();
+}
+
+void SphereFiller::openOutput() {
+	outFile = outputName(".out");
+	journalFile = outputName(".journal");
+	finished.clear();
+	outBytes = 0;
+
+	//the journal's first line records the run's parameters - only a matching run is continued
+	string signature = journalSignature();
+	vector<string> kept;
+	if (resume) {
+		ifstream journal(journalFile.c_str());
+		ifstream previous(outFile.c_str(), ios::binary | ios::ate);
+		long long outSize = previous.is_open() ? static_cast<long long>(previous.tellg()) : 0;
+		string line;
+		if (getline(journal,line) && line == signature) {
+			while (getline(journal,line)) {
+				vector<string> split = strSplitSpaces(line);
+				if (split.size() < 4) break; //torn final line
+				long long end = atoll(split[2].c_str());
+				if (end > outSize) break;
+				finished.insert(atol(split[0].c_str()));
+				outBytes = end;
+				kept.push_back(line);
+			}
+			cout << " resuming = " << finished.size() << " particles already complete" << endl;
+		} else {
+			cout << " *(note: no journal matching these parameters, starting over)" << endl;
+		}
+	}
+
+	//cut stale output and any partially written particle
+	if (outBytes > 0) {
+		if (truncate(outFile.c_str(), outBytes) != 0) {
+			cout << "*ERROR: cannot truncate " << outFile << ", starting over" << endl;
+			outBytes = 0;
+			finished.clear();
+			kept.clear();
+		}
+	}
+	if (outBytes == 0) {
+		ofstream fresh(outFile.c_str(), ios::trunc);
+	}
+	outStream.open(outFile.c_str(), ios::app | ios::binary);
+
+	journalStream.open(journalFile.c_str(), ios::trunc);
+	journalStream << signature << endl;
+	for (unsigned i = 0; i < kept.size(); ++i) journalStream << kept[i] << endl;
+}
+
+void SphereFiller::writeSpheres(long particleNum, vector<Sphere>& sphereList) {
+	std::stringstream record;
+	for (unsigned i = 0; i < sphereList.size(); ++i) {
+		record << particleNum << " " << sphereList[i].print();
+	}
+	string text = record.str();
+
+	long long begin = outBytes;
+	outStream << text;
+	outStream.flush();
+	outBytes += text.size();
+
+	//journal the particle only once its record has been handed to the file
+	journalStream << particleNum << " " << begin << " " << outBytes << " " << sphereList.size() << endl;
+	finished.insert(particleNum);
+}
+
+void SphereFiller::closeOutput() {
+	outStream.close();
+	journalStream.close();
+}
+
+string SphereFiller::surfaceFormat() {
+	string stem = outputName("");
+	string extension = inFile.substr(stem.size());
+	std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+	if (extension.compare(0,4,".stl") == 0) return "stl";
+	if (extension.compare(0,4,".ply") == 0) return "ply";
+	if (extension.compare(0,4,".obj") == 0) return "obj";
+	return "";
+}
+
+bool SphereFiller::readSurfaceFile(vector<Mesh>& meshes) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	string format = surfaceFormat();
+	string data;
+	if (!readWholeFile(inFile, data)) {
+		cout << "*ERROR: cannot read input file " << inFile << endl;
+		return false;
+	}
+	vector<double> coords;
+	vector<long> triangles;
+	bool ok = false;
+	if (format == "stl") ok = readSTL(data, coords, triangles);
+	if (format == "ply") ok = readPLY(data, coords, triangles);
+	if (format == "obj") ok = readOBJ(data, coords, triangles);
+	size_t bytes = data.size();
+	string().swap(data);
+	size_t nVertex = coords.size()/3;
+	for (size_t i = 0; ok && i < triangles.size(); ++i) ok = (triangles[i] >= 0 && static_cast<size_t>(triangles[i]) < nVertex);
+	if (!ok || triangles.empty()) {
+		cout << "*ERROR: cannot read " << format << " surface from " << inFile << endl;
+		return false;
+	}
+
+	//STL repeats every shared vertex, so vertices are merged within a fraction of the model size
+	double lo[3], hi[3];
+	for (int k = 0; k < 3; ++k) {lo[k] = coords[k]; hi[k] = coords[k];}
+	for (size_t v = 0; v < nVertex; ++v) for (int k = 0; k < 3; ++k) {
+		lo[k] = min(lo[k],coords[3*v+k]);
+		hi[k] = max(hi[k],coords[3*v+k]);
+	}
+	double tolerance = weldTolerance;
+	if (tolerance <= 0.0) tolerance = 1e-6*Vec3d(hi[0]-lo[0],hi[1]-lo[1],hi[2]-lo[2]).norm();
+	if (!(tolerance > 0.0)) tolerance = 1e-12;
+	vector<long> welded;
+	vector<double> unique;
+	long nUnique = weldVertices(coords, tolerance, welded, unique);
+	vector<double>().swap(coords);
+
+	//connected triangles form one particle, unless the file is one particle
+	vector<long> parent(nUnique);
+	for (long v = 0; v < nUnique; ++v) parent[v] = v;
+	vector<long> kept;
+	for (size_t t = 0; t+2 < triangles.size(); t += 3) {
+		long a = welded[triangles[t]], b = welded[triangles[t+1]], c = welded[triangles[t+2]];
+		if (a == b || b == c || a == c) continue;
+		//slivers whose third vertex lies within the weld tolerance of the other two's line have no usable area
+		Vec3d pa(unique[3*a],unique[3*a+1],unique[3*a+2]), pb(unique[3*b],unique[3*b+1],unique[3*b+2]), pc(unique[3*c],unique[3*c+1],unique[3*c+2]);
+		Vec3d ab = pb.minus(pa), ac = pc.minus(pa);
+		double longest = max(max(ab.norm(), ac.norm()), pc.minus(pb).norm());
+		if (!(ab.cross(ac).norm() > tolerance*longest)) continue;
+		kept.push_back(t);
+		parent[findRoot(parent,b)] = findRoot(parent,a);
+		parent[findRoot(parent,c)] = findRoot(parent,a);
+	}
+	map<long,unsigned> component;
+	vector<Node*> nodes(nUnique, static_cast<Node*>(NULL));
+	for (unsigned i = 0; i < kept.size(); ++i) {
+		long t = kept[i];
+		long v[3] = {welded[triangles[t]], welded[triangles[t+1]], welded[triangles[t+2]]};
+		long root = splitComponents ? findRoot(parent,v[0]) : 0;
+		if (!component.count(root)) {
+			component[root] = meshes.size();
+			meshes.push_back(Mesh());
+		}
+		Mesh& mesh = meshes[component[root]];
+		Node* n[3];
+		for (int k = 0; k < 3; ++k) {
+			if (!nodes[v[k]]) {
+				nodes[v[k]] = new Node(v[k]+1, unique[3*v[k]], unique[3*v[k]+1], unique[3*v[k]+2]);
+				mesh.noderoster.insert(mesh.noderoster.end(), pair<long,Node*> (v[k]+1,nodes[v[k]]));
+			}
+			n[k] = nodes[v[k]];
+		}
+		long tag = mesh.facetroster.size()+1;
+		Facet* facet = new Facet(tag, n[0], n[1], n[2]);
+		mesh.facetroster.insert(mesh.facetroster.end(), pair<long,Facet*> (tag,facet));
+		n[0]->addFacet(facet);
+		n[1]->addFacet(facet);
+		n[2]->addFacet(facet);
+	}
+	for (unsigned i = 0; i < meshes.size(); ++i) meshes[i].tag = i+1;
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	cout << "*SURFACE READ (" << format << ")" << endl;
+	cout << "    triangles = " << kept.size() << " (" << triangles.size()/3 - kept.size() << " degenerate dropped)" << endl;
+	cout << "    vertices = " << nVertex << ", welded to " << nUnique << " within " << tolerance << endl;
+	cout << "    particles = " << meshes.size() << endl;
+	cout << "    read time = " << seconds << " s (" << bytes/1.0e6/max(seconds,1e-9) << " MB/s)" << endl;
+	return true;
+}
+
+bool SphereFiller::openInput() {
+	particleNum = 0;
+	surfaceMeshes.clear();
+	surfaceNext = 0;
+	if (surfaceFormat() != "") {
+		//surface files are read whole, each connected surface is a particle
+		return readSurfaceFile(surfaceMeshes);
+	}
+	if (!input.open(inFile)) {
+		cout << "*ERROR: cannot open input file " << inFile << endl;
+		return false;
+	}
+	return true;
+}
+
+bool SphereFiller::readNextMesh(Mesh& mesh) {
+	if (surfaceNext < surfaceMeshes.size()) {
+		mesh = surfaceMeshes[surfaceNext++];
+		return true;
+	}
+
+	while (!input.eof()) {
+		mesh = Mesh();
 
 		string line;
 		bool node = false;
 		bool element = false;
 
-		while (getline(infile,line)) {
+		while (input.getline(line)) {
 			if (line.substr(0,5) == "*Node" || line.substr(0,5) == "*NODE") {
 				node = true;
 				element = false;
@@ -510,32 +2108,217 @@ void SphereFiller::parseInputFile (bool load_all)  {
 			}
 		}
 	
-		//if mesh is not empty, save or process it
+		//a particle cut off by damaged input is never filled
+		if (input.failed()) return false;
+
+		//skip empty blocks, particles are numbered by block all the same
 		particleNum++;
 		mesh.tag = particleNum;
-		if (mesh.noderoster.size() > 0 && mesh.facetroster.size() > 0) {
-			if (load_all) {
-				//save
-				meshroster.push_back(mesh);
+		if (mesh.noderoster.size() > 0 && mesh.facetroster.size() > 0) return true;
+	}
+	return false;
+}
+
+void SphereFiller::closeInput() {
+	input.close();
+	vector<Mesh>().swap(surfaceMeshes);
+}
+
+/*Batch methods---------------------------------------------------------------*/
+
+void Batch::run() {
+
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point start = Clock::now();
+	size_t capacity = (queueDepth > 0) ? queueDepth : 2*threads;
+
+	//one particle, or the end of a file, on its way through the pipeline
+	struct Work {
+		unsigned file;
+		long seq;
+		bool fill;
+		bool endOfFile;
+		bool opened;   //end of a file whose output was opened
+		bool complete; //end of a file that was read to its end
+		Mesh mesh;
+		vector<Sphere> spheres;
+		FillReport report;
+	};
+
+	std::mutex lock;
+	std::condition_variable space, work, ready;
+	std::deque<Work*> pending;     //read, waiting for a filler
+	map<long,Work*> finished;      //filled, waiting for their turn to be written
+	size_t inFlight = 0;           //read but not yet written - bounded by capacity
+	long submitted = 0;
+	bool readerDone = false;
+
+	//statistics
+	double readerStall = 0.0, fillerIdle = 0.0, writerWait = 0.0;
+	double depthSum = 0.0;
+	size_t depthMax = 0, depthSamples = 0;
+	long filled = 0, totalSpheres = 0;
+	double smallest = std::numeric_limits<double>::max();
+
+	auto submit = [&](Work* w) {
+		std::unique_lock<std::mutex> guard(lock);
+		Clock::time_point wait = Clock::now();
+		space.wait(guard, [&]{return inFlight < capacity;});
+		readerStall += std::chrono::duration<double>(Clock::now() - wait).count();
+		w->seq = submitted++;
+		inFlight++;
+		if (w->fill) {
+			pending.push_back(w);
+			depthSum += pending.size();
+			depthMax = max(depthMax, pending.size());
+			depthSamples++;
+			work.notify_one();
+		} else {
+			finished[w->seq] = w;
+			ready.notify_one();
+		}
+	};
+
+	std::thread reader([&]() {
+		for (unsigned f = 0; f < files.size(); ++f) {
+			SphereFiller* sf = files[f];
+			//output and journal are only cut once the input is known to be readable
+			bool open = sf->openInput();
+			if (open) sf->openOutput();
+			set<long> skip = sf->completed();
+			vector<Mesh> loaded;
+			if (open && sf->budget > 0) {
+				//a budget needs every particle of the file before any can be filled
+				Mesh mesh;
+				while (sf->readNextMesh(mesh)) sf->meshroster.push_back(mesh);
+				sf->allocateBudget();
+				loaded.swap(sf->meshroster);
+			}
+			for (size_t next = 0; open; ) {
+				Work* w = new Work();
+				if (sf->budget > 0) {
+					if (next == loaded.size()) {delete w; break;}
+					w->mesh = loaded[next++];
+				} else if (!sf->readNextMesh(w->mesh)) {
+					delete w;
+					break;
+				}
+				w->file = f;
+				w->endOfFile = false;
+				w->fill = !skip.count(w->mesh.tag);
+				//already written by an earlier run - the library still needs volume and centroid
+				if (!w->fill) w->mesh.calculateVolume();
+				submit(w);
+			}
+			bool complete = !sf->inputFailed();
+			sf->closeInput();
+			vector<Mesh>().swap(loaded);
+
+			Work* end = new Work();
+			end->file = f;
+			end->fill = false;
+			end->endOfFile = true;
+			end->opened = open;
+			end->complete = complete;
+			submit(end);
+		}
+		std::lock_guard<std::mutex> guard(lock);
+		readerDone = true;
+		work.notify_all();
+		ready.notify_all();
+	});
+
+	auto filler = [&]() {
+		while (true) {
+			Work* w;
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				Clock::time_point wait = Clock::now();
+				work.wait(guard, [&]{return !pending.empty() || readerDone;});
+				fillerIdle += std::chrono::duration<double>(Clock::now() - wait).count();
+				if (pending.empty()) return;
+				w = pending.front();
+				pending.pop_front();
+			}
+			SphereFiller* sf = files[w->file];
+			w->mesh.fillSpheres(sf->fillOptions(w->mesh.tag), w->spheres, w->report);
+			std::lock_guard<std::mutex> guard(lock);
+			finished[w->seq] = w;
+			ready.notify_one();
+		}
+	};
+	vector<std::thread> pool;
+	for (int t = 0; t < threads; ++t) pool.push_back(std::thread(filler));
+
+	//writer - results leave in the order they were read
+	for (long seq = 0; ; ++seq) {
+		Work* w;
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			Clock::time_point wait = Clock::now();
+			ready.wait(guard, [&]{return finished.count(seq) || (readerDone && seq == submitted);});
+			writerWait += std::chrono::duration<double>(Clock::now() - wait).count();
+			if (!finished.count(seq)) break;
+			w = finished[seq];
+			finished.erase(seq);
+		}
+		SphereFiller* sf = files[w->file];
+		if (w->endOfFile) {
+			if (w->opened) {
+				sf->closeOutput();
+				if (!w->complete) {
+					//particles written so far stay journaled, so --resume picks up once the file is repaired
+					cout << "*ERROR: " << sf->inFile << " ended early - particles after the last one written were not filled";
+					if (sf->library) cout << ", no library built";
+					cout << endl;
+				} else if (sf->library) sf->buildLibrary();
+			}
+		} else {
+			if (w->fill) {
+				sf->writeSpheres(w->mesh.tag, w->spheres);
+				filled++;
+				totalSpheres += w->spheres.size();
+				cout << "*PARTICLE " << w->mesh.tag << " OF " << sf->inFile << " - " << w->spheres.size() << " spheres, " << 100.0*w->report.coverage << "% coverage, " << w->report.seconds << " s" << endl;
+				cout << "    sphere radius = " << w->report.minRadius << " min, " << w->report.meanRadius << " mean, " << w->report.maxRadius << " max";
+				if (w->report.rejected > 0) cout << ", " << w->report.rejected << " bases below minimum radius";
+				cout << endl;
+				if (sf->clearance == CLEARANCE_EXACT) {
+					cout << "    exact clearance: tree built in " << w->report.treeSeconds << " s, " << w->report.triangleTests << " triangle tests, " << w->report.treeVisits << " boxes visited" << endl;
+				}
+				if (!w->spheres.empty()) smallest = min(smallest, w->report.minRadius);
 			} else {
-				//process
-				mesh.buildSpheres(particleNum, density, nSphere, minDist, inFile);
-				meshroster.push_back(mesh);
+				cout << "*PARTICLE " << w->mesh.tag << " OF " << sf->inFile << " ALREADY COMPLETE - skipped" << endl;
 			}
+			//only the library needs the particle again
+			if (sf->library) sf->meshroster.push_back(w->mesh);
+			else w->mesh.clear();
 		}
-				
+		delete w;
+		std::lock_guard<std::mutex> guard(lock);
+		inFlight--;
+		space.notify_one();
 	}
-
-	infile.close();
-
-	cout << "*INPUT FILE PARSED" << endl;
-	if (load_all) cout << "    mesh roster size = " << meshroster.size() << endl;	
-	for (unsigned i = 0; i < meshroster.size(); ++i) {
-		cout << "    node roster size = " << meshroster[i].noderoster.size() << endl;
-		cout << "    facet/element roster size = " << meshroster[i].facetroster.size() << endl;
+	reader.join();
+	for (unsigned t = 0; t < pool.size(); ++t) pool[t].join();
+
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	cout << "*BATCH COMPLETE" << endl;
+	cout << "    files = " << files.size() << endl;
+	cout << "    particles filled = " << filled << endl;
+	cout << "    spheres written = " << totalSpheres << endl;
+	if (totalSpheres > 0) cout << "    smallest sphere radius = " << smallest << endl;
+	cout << "    wall time = " << seconds << " s" << endl;
+	if (seconds > 0.0) {
+		cout << "    particles per second = " << filled/seconds << endl;
+		cout << "    spheres per second = " << totalSpheres/seconds << endl;
 	}
-
-	return;
+	cout << "*PIPELINE STATISTICS" << endl;
+	cout << "    filling threads = " << threads << endl;
+	cout << "    particles in flight at most = " << capacity << endl;
+	if (depthSamples > 0) cout << "    fill queue depth = " << depthSum/depthSamples << " mean, " << depthMax << " max" << endl;
+	cout << "    reader stalled on a full pipeline = " << readerStall << " s" << endl;
+	cout << "    fillers idle waiting for particles = " << fillerIdle << " s (all threads)" << endl;
+	cout << "    writer waiting for the next particle = " << writerWait << " s" << endl;
 }
 
 /*
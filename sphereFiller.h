@@ -38,6 +38,9 @@
 #include <cassert>
 #include <map>
 #include <set>
+#include <limits>
+#include <random>
+#include <fstream>
 
 #ifndef __SPHEREFILLER_H__
 #define __SPHEREFILLER_H__
@@ -95,6 +98,162 @@ private:
 };
 
 
+class Mat3d {
+public:
+    Mat3d (){
+		for (int i = 0; i < 3; ++i) for (int j = 0; j < 3; ++j) a[i][j] = 0.0;
+	};
+    ~Mat3d (){};
+
+	static Mat3d identity() {
+		Mat3d out;
+		out.a[0][0] = out.a[1][1] = out.a[2][2] = 1.0;
+		return out;
+	};
+	//matrix whose columns are the given vectors
+	static Mat3d columns(Vec3d c0, Vec3d c1, Vec3d c2) {
+		Mat3d out;
+		out.setColumn(0,c0); out.setColumn(1,c1); out.setColumn(2,c2);
+		return out;
+	};
+
+	double get(int i, int j) {return a[i][j];};
+	void set(int i, int j, double val) {a[i][j] = val;};
+	Vec3d getColumn(int j) {return Vec3d(a[0][j],a[1][j],a[2][j]);};
+	void setColumn(int j, Vec3d in) {
+		a[0][j] = in.getX(); a[1][j] = in.getY(); a[2][j] = in.getZ();
+	};
+
+	Vec3d mult(Vec3d in) {
+		double x = in.getX(), y = in.getY(), z = in.getZ();
+		return Vec3d(a[0][0]*x + a[0][1]*y + a[0][2]*z,
+		             a[1][0]*x + a[1][1]*y + a[1][2]*z,
+		             a[2][0]*x + a[2][1]*y + a[2][2]*z);
+	};
+	Mat3d mult(Mat3d in) {
+		Mat3d out;
+		for (int i = 0; i < 3; ++i) for (int j = 0; j < 3; ++j)
+			for (int k = 0; k < 3; ++k) out.a[i][j] += a[i][k]*in.a[k][j];
+		return out;
+	};
+	Mat3d transpose() {
+		Mat3d out;
+		for (int i = 0; i < 3; ++i) for (int j = 0; j < 3; ++j) out.a[i][j] = a[j][i];
+		return out;
+	};
+
+	void eigenSymmetric(Vec3d& values, Mat3d& vectors);
+	void toQuaternion(double q[4]);
+
+private:
+	double a[3][3];
+};
+
+
+//how base nodes are chosen
+enum Selection {
+	SELECT_RANDOM,  //uniformly at random (Ferellec)
+	SELECT_GREEDY   //largest uncovered surface area first
+};
+
+//how minDist between base nodes is measured
+enum Spacing {
+	SPACING_EUCLIDEAN, //straight line
+	SPACING_GEODESIC   //shortest path along mesh edges
+};
+
+//how each base node's inscribed sphere is found
+enum Engine {
+	ENGINE_BISECT, //radius search per base node (Ferellec)
+	ENGINE_MEDIAL  //medial-axis balls of every node in one sweep
+};
+
+//what counts as a sphere poking out of the particle
+enum Clearance {
+	CLEARANCE_NODES, //a mesh node inside the sphere
+	CLEARANCE_EXACT  //any part of a facet inside the sphere
+};
+
+//per-particle fill parameters, passed by value so concurrent fills share nothing
+class FillOptions {
+public:
+    FillOptions (){
+		nSphere = 1;
+		density = 1.0;
+		minDist = 0.0;
+		seed = 0;
+		selection = SELECT_RANDOM;
+		spacing = SPACING_EUCLIDEAN;
+		clearance = CLEARANCE_NODES;
+		engine = ENGINE_BISECT;
+		minRadius = 0.0;
+		minRadiusRelative = 0.0;
+	};
+    ~FillOptions (){};
+
+	long nSphere;
+	double density;
+	double minDist;
+	unsigned seed;
+	Selection selection;
+	Spacing spacing;
+	Clearance clearance;
+	Engine engine;
+	//bases whose sphere comes out smaller than the larger of these are passed over
+	double minRadius;
+	double minRadiusRelative; //times the radius of a sphere of the particle's volume
+};
+
+//what a fill achieved
+class FillReport {
+public:
+    FillReport (){
+		coverage = 0.0;
+		seconds = 0.0;
+		treeSeconds = 0.0;
+		triangleTests = 0;
+		treeVisits = 0;
+		minRadius = 0.0;
+		meanRadius = 0.0;
+		maxRadius = 0.0;
+		rejected = 0;
+	};
+    ~FillReport (){};
+
+	double coverage; //fraction of surface area lying on or near a sphere
+	double seconds;  //whole fill
+	//exact clearance cost
+	double treeSeconds;
+	long triangleTests;
+	long treeVisits;
+	//sizes of the spheres kept, and bases passed over for a sphere below the minimum radius
+	double minRadius;
+	double meanRadius;
+	double maxRadius;
+	long rejected;
+};
+
+//line reader for input files - gzip (and zstd, when built with SPHEREFILLER_ZSTD)
+//are decompressed as they are read, and *INCLUDE, INPUT=file is followed in place
+class InputReader {
+public:
+    InputReader () : broken(false) {};
+    ~InputReader () {close();};
+
+	bool open(string path);
+	bool getline(string& line);
+	bool eof() {return streams.empty();};
+	bool failed() {return broken;}; //read ended on corrupt or cut-off data
+	void close();
+private:
+	bool broken;
+	bool push(string path);
+	void pop();
+	vector<std::streambuf*> buffers;
+	vector<std::istream*> streams;
+	vector<string> paths;
+};
+
 class SphereFiller {
 public:
     SphereFiller (){};
@@ -104,13 +263,88 @@ public:
 	double density;
 	double minDist;
 	long nSphere;
+	unsigned seed;
+	Selection selection;
+	Spacing spacing;
+	Clearance clearance;
+	Engine engine;
+	double minRadius;
+	double minRadiusRelative;
 	vector<Mesh> meshroster;
 	bool library;
+	double dedupTolerance; //<= 0 writes one molecule per particle
+	bool principal;
+	int treeLeaf; //> 0 adds a bounding-sphere tree per molecule, at most this many atoms per leaf
+	bool resume; //continue an interrupted run from its journal
+	long budget; //> 0 shares this many spheres over all particles instead of nSphere each
+	map<long,long> allocation; //spheres per particle tag under a budget
+
+	//particle-at-a-time reading for Batch
+	bool openInput();
+	bool readNextMesh(Mesh& mesh);
+	bool inputFailed() {return input.failed();}; //reading stopped short of the end of the file
+	void closeInput();
 
-	void parseInputFile(bool load_all);
 	void buildLibrary();
+	void allocateBudget();
+
+	//sphere output with a per-particle completion journal
+	void openOutput();
+	void writeSpheres(long particleNum, vector<Sphere>& sphereList);
+	void closeOutput();
+	string journalSignature();
+	string outputName(string suffix);
+	set<long> completed() {return finished;};
+
+	//STL, PLY and OBJ input
+	double weldTolerance; //<= 0 merges vertices within 1e-6 of the model size
+	bool splitComponents; //each connected surface is a particle, else the whole file is one
+	string surfaceFormat();
+	bool readSurfaceFile(vector<Mesh>& meshes);
+
+	//each particle draws from its own seed so results don't depend on processing order
+	FillOptions fillOptions(long particleNum) {
+		FillOptions options;
+		map<long,long>::const_iterator share = allocation.find(particleNum);
+		options.nSphere = (share == allocation.end()) ? nSphere : share->second;
+		options.density = density;
+		options.minDist = minDist;
+		options.seed = seed + static_cast<unsigned>(particleNum);
+		options.selection = selection;
+		options.spacing = spacing;
+		options.clearance = clearance;
+		options.engine = engine;
+		options.minRadius = minRadius;
+		options.minRadiusRelative = minRadiusRelative;
+		return options;
+	};
 private:
+	string outFile;
+	string journalFile;
+	set<long> finished;
+	ofstream outStream;
+	ofstream journalStream;
+	long long outBytes;
+	InputReader input;
+	vector<Mesh> surfaceMeshes;
+	size_t surfaceNext;
+	int particleNum;
+
+};
+
+//input files run through a pipeline: one thread reads particles ahead, a pool of
+//threads fills them and the calling thread writes them out in particle order
+class Batch {
+public:
+    Batch () : threads(1), queueDepth(0) {};
+    ~Batch (){};
+
+	vector<SphereFiller*> files;
+	int threads;    //filling threads
+	int queueDepth; //particles read but not yet written, <= 0 for twice the threads
 
+	//output of every file is identical to a sequential run
+	void run();
 };
 
 class Node {
@@ -136,8 +370,6 @@ public:
 
     ~Node (){}; 
 	
-	set<Node*> neighbors;
-
 	vector<Facet*> getFacets() {return facets;};
 	void addFacet (Facet * in) {facets.push_back(in);};
 	Vec3d getCoordinates () {return coordinates;};
@@ -147,6 +379,10 @@ public:
 	void setID (long inID) {
 		id = inID;
 	};
+	long getIndex() {return index;}
+	void setIndex (long inIndex) {
+		index = inIndex;
+	};
 
 	double dist(Node* other) {
 		Vec3d c1 = getCoordinates();
@@ -165,6 +401,7 @@ private:
 	vector<Facet*> facets;
 	Vec3d coordinates;
 	long id;
+	long index;
 
 };
 
@@ -265,10 +502,60 @@ private:
 	long id;
 };
 
+//bounding volume hierarchy over a mesh's facets, built once and queried with spheres
+class FacetTree {
+public:
+    FacetTree (){};
+    ~FacetTree (){};
+
+	void build(map<long,Facet*>& facetroster);
+	bool intersects(Sphere* sph, long& tests, long& visits);
+	bool within(Vec3d point, double distance); //some facet lies closer than distance to point
+	bool empty() {return boxes.empty();};
+
+private:
+	class Box {
+	public:
+		double lo[3];
+		double hi[3];
+		long left;  //children, -1 for a leaf
+		long right;
+		long first; //leaf facets are facets[first] .. facets[first+count-1]
+		long count;
+	};
+	vector<Box> boxes;
+	vector<Facet*> facets;
+	long buildRange(vector<Vec3d>& centers, long first, long count);
+};
+
+//kd-tree over mesh nodes for nearest-node and radius queries
+class NodeTree {
+public:
+    NodeTree (){};
+    ~NodeTree (){};
+
+	void build(vector<Node*>& inNodes);
+	Node* nearest(Vec3d point, Node* skip, double maxDist);
+	void within(Vec3d point, double radius, vector<Node*>& found);
+	bool empty() {return nodes.empty();};
+
+private:
+	//implicit tree: the median of [lo,hi) sits at (lo+hi)/2, splits on axis[(lo+hi)/2]
+	//and stores the bounds of the range in boxes[6*((lo+hi)/2)] (low xyz, high xyz)
+	vector<Node*> nodes;
+	vector<double> coords;
+	vector<int> axis;
+	vector<double> boxes;
+	void buildRange(long lo, long hi);
+	double boxDistance2(long lo, long hi, double p[3]);
+	void nearestRange(long lo, long hi, double p[3], Node* skip, Node*& best, double& bestD2);
+	void withinRange(long lo, long hi, double p[3], double r2, vector<Node*>& found);
+};
+
 class Mesh {
 public:
-    Mesh (){};
-    Mesh (long in){tag = in;};
+    Mesh (){clearance = CLEARANCE_NODES; engine = ENGINE_BISECT;};
+    Mesh (long in){tag = in; clearance = CLEARANCE_NODES; engine = ENGINE_BISECT;};
     ~Mesh (){}; 
 
 	long tag;
@@ -276,11 +563,34 @@ public:
 	map<long, Facet*> facetroster;
 
 	bool clearSphere(Sphere* sph);
+	Clearance clearance; //test used by clearSphere
+	FacetTree facetTree; //built by fillSpheres for exact clearance
+	long triangleTests;
+	long treeVisits;
 	void bisectRadius(Sphere* sph, double rSmall, double rBig, int count);
 	void buildNodeGraph();
 	void printNodeGraph();
+	vector<long> adjStart; //neighbors of nodeList[i] are adjList[adjStart[i]] .. adjList[adjStart[i+1]-1]
+	vector<long> adjList;
 //	void buildMeshes();
-	void buildSpheres(int particleNum, double density, int nSpheres, double minDist, string inFile);
+	void fillSpheres(FillOptions options, vector<Sphere>& sphereList, FillReport& report);
+	void selectRandom(FillOptions options, int nSphere, vector<Sphere>& sphereList);
+	void selectGreedy(FillOptions options, int nSphere, vector<Sphere>& sphereList);
+	Sphere inscribeSphere(Node* n1);
+	Engine engine;        //used by inscribeSphere
+	double radiusFloor;   //smallest sphere selectRandom and selectGreedy may keep
+	long rejectedBases;
+	vector<Sphere> poles; //medial ball of nodeList[i], filled by buildPoles
+	NodeTree nodeTree;
+	void buildPoles();
+	bool coversNode(Sphere* sph, Node* node);
+	double surfaceCoverage(vector<Sphere>& sphereList);
+	void indexNodes();
+	bool spacingAllows(Node* node, vector<Node*>& bases, FillOptions& options, vector<bool>& blocked);
+	void acceptBase(Node* node, vector<Node*>& bases, FillOptions& options, vector<bool>& blocked);
+	void blockGeodesic(long source, double radius, vector<bool>& blocked);
+	vector<Node*> nodeList; //noderoster in order, position stored as Node::index
+	void clear();
 	Vec3d meshCentroid() {
 		//if (&centroid) return centroid;
 		centroid = Vec3d(0.0,0.0,0.0);
@@ -295,6 +605,11 @@ public:
 	void removeConnected(set<Node*>& nodework, Node* node);
 
 	double calculateVolume();
+	double calculateArea();
+	double totalCurvature();
+	Mat3d inertiaTensor(Vec3d& center, double& vol);
+	void principalFrame(Vec3d& center, Vec3d& moments, Mat3d& axes);
+	bool overlays(Mesh& target, Mat3d rotation, Vec3d center, Vec3d targetCenter, double tolerance);
 
 	double getVolume() {
 		return volume;
@@ -322,6 +637,7 @@ private:
 ////	vector<Facet*> facets;
 	Vec3d centroid;
 	double volume;
+	vector<double> geodesicDist; //scratch for blockGeodesic, kept at infinity between calls
 };
 
 
@@ -357,7 +673,9 @@ public:
 		centroid = centroid.plus(normal.mult(inrad));	
 	};
 	void setCentroid(Vec3d invec) {centroid = invec;};
+	void setMass(double inmass) {mass = inmass;};
 	double getRadius() {return radius;};
+	double getMass() {return mass;};
 	Vec3d getCentroid() {return centroid;};
 	Node* getBase() {return base;};
 
@@ -0,0 +1,114 @@
+/*******************************************************************************
+
+  Embeddable interface to <sphereFiller> - see sphereFillerAPI.h
+
+  This program is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version. See sphereFiller.c for citation requests.
+
+*******************************************************************************/
+#include "sphereFillerAPI.h"
+#include "sphereFiller.h"
+
+using namespace std;
+
+bool sfFillMesh(const double* vertices, size_t nVertices,
+                const long* triangles, size_t nTriangles,
+                const SFOptions& options, SFResult& result) {
+
+	result.spheres.clear();
+	result.mass = SFMassProperties();
+	result.coverage = 0.0;
+	result.seconds = 0.0;
+	result.treeSeconds = 0.0;
+	result.triangleTests = 0;
+	result.treeVisits = 0;
+	if (!vertices || !triangles || nVertices == 0 || nTriangles == 0 || options.nSphere < 1) return false;
+	for (size_t i = 0; i < 3*nTriangles; ++i) {
+		if (triangles[i] < 0 || static_cast<size_t>(triangles[i]) >= nVertices) return false;
+	}
+
+	//copy buffers into a private mesh - only vertices used by a triangle become nodes
+	Mesh mesh = Mesh(1);
+	vector<Node*> nodes(nVertices, static_cast<Node*>(NULL));
+	for (size_t f = 0; f < nTriangles; ++f) {
+		Node* n[3];
+		for (int k = 0; k < 3; ++k) {
+			long v = triangles[3*f+k];
+			if (!nodes[v]) {
+				nodes[v] = new Node(v, vertices[3*v], vertices[3*v+1], vertices[3*v+2]);
+				mesh.noderoster.insert(pair<long,Node*> (v,nodes[v]));
+			}
+			n[k] = nodes[v];
+		}
+		long tag = static_cast<long>(f);
+		Facet* facet = new Facet(tag, n[0], n[1], n[2]);
+		mesh.facetroster.insert(pair<long,Facet*> (tag,facet));
+		n[0]->addFacet(facet);
+		n[1]->addFacet(facet);
+		n[2]->addFacet(facet);
+		if (!(facet->getArea() > 0.0)) {
+			mesh.clear();
+			return false;
+		}
+	}
+
+	FillOptions fill;
+	fill.nSphere = options.nSphere;
+	fill.density = options.density;
+	fill.minDist = options.minDist;
+	fill.seed = options.seed;
+	fill.selection = options.greedy ? SELECT_GREEDY : SELECT_RANDOM;
+	fill.spacing = options.geodesic ? SPACING_GEODESIC : SPACING_EUCLIDEAN;
+	fill.clearance = options.exactClearance ? CLEARANCE_EXACT : CLEARANCE_NODES;
+	fill.engine = options.medial ? ENGINE_MEDIAL : ENGINE_BISECT;
+	fill.minRadius = options.minRadius;
+	fill.minRadiusRelative = options.minRadiusRelative;
+
+	vector<Sphere> sphereList;
+	FillReport report;
+	mesh.fillSpheres(fill, sphereList, report);
+	result.coverage = report.coverage;
+	result.seconds = report.seconds;
+	result.treeSeconds = report.treeSeconds;
+	result.triangleTests = report.triangleTests;
+	result.treeVisits = report.treeVisits;
+
+	for (unsigned i = 0; i < sphereList.size(); ++i) {
+		SFSphere out;
+		Vec3d c = sphereList[i].getCentroid();
+		out.x = c.getX();
+		out.y = c.getY();
+		out.z = c.getZ();
+		out.radius = sphereList[i].getRadius();
+		out.mass = sphereList[i].getMass();
+		result.spheres.push_back(out);
+	}
+
+	//mass properties of the surface, scaled by density
+	Vec3d center, moments;
+	Mat3d axes;
+	double volume;
+	Mat3d inertia = mesh.inertiaTensor(center, volume);
+	mesh.principalFrame(center, moments, axes);
+	SFMassProperties& props = result.mass;
+	props.volume = volume;
+	props.mass = volume*options.density;
+	props.centroid[0] = center.getX();
+	props.centroid[1] = center.getY();
+	props.centroid[2] = center.getZ();
+	props.inertia[0] = inertia.get(0,0)*options.density;
+	props.inertia[1] = inertia.get(1,1)*options.density;
+	props.inertia[2] = inertia.get(2,2)*options.density;
+	props.inertia[3] = inertia.get(0,1)*options.density;
+	props.inertia[4] = inertia.get(1,2)*options.density;
+	props.inertia[5] = inertia.get(0,2)*options.density;
+	props.principalMoments[0] = moments.getX()*options.density;
+	props.principalMoments[1] = moments.getY()*options.density;
+	props.principalMoments[2] = moments.getZ()*options.density;
+	for (int i = 0; i < 3; ++i) for (int j = 0; j < 3; ++j) props.principalAxes[3*i+j] = axes.get(i,j);
+
+	mesh.clear();
+	return true;
+}
@@ -0,0 +1,74 @@
+/*******************************************************************************
+
+  Embeddable interface to <sphereFiller>
+
+  Fills a closed triangulated surface held in memory with spheres, without
+  touching the filesystem. The header is self-contained so that it can be
+  included next to any other code; link against libsphereFiller.a or
+  libsphereFiller.so.
+
+  Every call works on its own copy of the mesh and its own random generator,
+  so sfFillMesh may be called from several threads at once.
+
+  This program is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version. See sphereFiller.c for citation requests.
+
+*******************************************************************************/
+#include <vector>
+#include <cstddef>
+
+#ifndef __SPHEREFILLERAPI_H__
+#define __SPHEREFILLERAPI_H__
+
+struct SFOptions {
+	SFOptions () : nSphere(1), density(1.0), minDist(0.0), seed(0), greedy(false), geodesic(false),
+	               exactClearance(false), medial(false), minRadius(0.0), minRadiusRelative(0.0) {};
+
+	long nSphere;     //spheres per particle (capped at the vertex count)
+	double density;   //particle density, every sphere gets an equal share of the mass
+	double minDist;   //minimum distance between base vertices of spheres
+	unsigned seed;    //same seed and mesh give the same spheres
+	bool greedy;      //pick bases by largest uncovered area instead of at random,
+	                  //may stop short of nSphere once the surface is covered
+	bool geodesic;    //measure minDist along the surface instead of straight through
+	bool exactClearance; //keep spheres clear of whole facets, not just of vertices
+	bool medial;      //size spheres from medial-axis balls of all vertices in one sweep
+	double minRadius; //skip bases whose sphere would be smaller than this,
+	double minRadiusRelative; //or than this times the radius of a sphere of the particle's volume
+};
+
+struct SFSphere {
+	double x, y, z;
+	double radius;
+	double mass;
+};
+
+struct SFMassProperties {
+	double volume;
+	double mass;
+	double centroid[3];          //center of mass
+	double inertia[6];           //about the centroid: xx, yy, zz, xy, yz, xz
+	double principalMoments[3];  //ascending
+	double principalAxes[9];     //row-major, columns are the principal axes
+};
+
+struct SFResult {
+	std::vector<SFSphere> spheres;
+	SFMassProperties mass;
+	double coverage;  //fraction of surface area lying on or near a sphere
+	double seconds;   //time spent filling
+	double treeSeconds; //with exactClearance: time building the facet tree (part of seconds),
+	long triangleTests; //sphere-triangle tests made
+	long treeVisits;    //and tree boxes visited
+};
+
+// vertices:  nVertices*3 coordinates (x0 y0 z0 x1 ...)
+// triangles: nTriangles*3 zero-based vertex indices, counter-clockwise seen from outside
+// returns false (and leaves result empty) if the buffers don't describe a usable mesh
+bool sfFillMesh(const double* vertices, size_t nVertices,
+                const long* triangles, size_t nTriangles,
+                const SFOptions& options, SFResult& result);
+
+#endif//__SPHEREFILLERAPI_H__